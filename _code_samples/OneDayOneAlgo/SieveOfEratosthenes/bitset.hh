@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Packed sieves only store odd numbers: bit i stands for 2i + 1, in 64 bits words.
+
+// Small primes crossed off by copying a precomputed pattern rather than one multiple at a time
+constexpr std::array<uint32_t, 5> presieve_primes { 3, 5, 7, 11, 13 };
+
+// Length of the pattern in words: since it is also a multiple of every presieve prime in
+// bits, word w of the sieve always matches word w % presieve_period of the pattern.
+constexpr size_t presieve_period = 3 * 5 * 7 * 11 * 13;
+
+inline std::vector<uint64_t> make_presieve_pattern()
+{
+    std::vector<uint64_t> pattern(presieve_period, ~uint64_t(0));
+    for (uint64_t p : presieve_primes) {
+        for (uint64_t i = p / 2; i < presieve_period * 64; i += p) {
+            pattern[i / 64] &= ~(uint64_t(1) << (i % 64));
+        }
+    }
+    return pattern;
+}
+
+inline const std::vector<uint64_t> presieve_pattern = make_presieve_pattern();
+
+// Fills words with the pattern, words[0] being word first_word of the sieve
+inline void presieve(std::span<uint64_t> words, uint64_t first_word)
+{
+    size_t offset = first_word % presieve_period;
+    for (size_t w = 0; w != words.size();) {
+        size_t n = std::min(words.size() - w, presieve_period - offset);
+        std::copy_n(presieve_pattern.begin() + offset, n, words.begin() + w);
+        w += n;
+        offset = 0;
+    }
+}
+
+// Bits of the presieve primes, which the pattern crossed off as multiples of themselves
+constexpr uint64_t presieve_primes_mask()
+{
+    uint64_t mask = 0;
+    for (uint64_t p : presieve_primes) {
+        mask |= uint64_t(1) << (p / 2);
+    }
+    return mask;
+}
+
+// Primality of every number up to n, 16 numbers per byte
+class odd_bitset
+{
+public:
+    explicit odd_bitset(uint64_t n) : n_(n), words_((n / 2 + 64) / 64) {}
+
+    bool is_prime(uint64_t k) const
+    {
+        if (k > n_ or k % 2 == 0) {
+            return k == 2 and n_ >= 2;
+        }
+        return words_[k / 128] >> (k / 2 % 64) & 1;
+    }
+
+    uint64_t count() const
+    {
+        uint64_t count = n_ >= 2;
+        for (uint64_t w : words_) {
+            count += std::popcount(w);
+        }
+        return count;
+    }
+
+    std::span<uint64_t> words()
+    {
+        return words_;
+    }
+
+    size_t bytes() const
+    {
+        return words_.size() * sizeof(uint64_t);
+    }
+
+private:
+    uint64_t              n_;
+    std::vector<uint64_t> words_;
+};
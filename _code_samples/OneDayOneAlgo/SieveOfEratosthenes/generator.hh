@@ -0,0 +1,120 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <ranges>
+#include <vector>
+
+#include "segmented.hh"
+
+// Primes lo <= p < hi as a lazy input range: a window is only sieved when the consumer
+// reaches it, so primes() | std::views::take_while(...) stops sieving with the consumer.
+// The range goes through stages of doubling length, each with its own segmented_sieve: the
+// first prime comes after a tiny sieve wherever the range starts, and the base primes only
+// ever go up to the square root of the numbers actually reached.
+class prime_view : public std::ranges::view_interface<prime_view>
+{
+public:
+    static constexpr uint64_t max_bound   = uint64_t(1) << 62;
+    static constexpr uint64_t first_stage = 1 << 16;
+
+    class iterator
+    {
+    public:
+        using value_type      = uint64_t;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() = default;
+
+        explicit iterator(prime_view* view) : view_(view) {}
+
+        uint64_t operator*() const
+        {
+            return view_->window_[view_->pos_];
+        }
+
+        iterator& operator++()
+        {
+            ++view_->pos_;
+            view_->settle();
+            return *this;
+        }
+
+        void operator++(int)
+        {
+            ++*this;
+        }
+
+        bool operator==(std::default_sentinel_t) const
+        {
+            return view_->done_;
+        }
+
+    private:
+        prime_view* view_ = nullptr;
+    };
+
+    prime_view() = default;
+
+    prime_view(uint64_t lo, uint64_t hi = max_bound) : next_(lo), hi_(std::min(hi, max_bound))
+    {
+    }
+
+    // Single pass: begin() resumes where the previous iteration stopped
+    iterator begin()
+    {
+        settle();
+        return iterator { this };
+    }
+
+    std::default_sentinel_t end() const
+    {
+        return {};
+    }
+
+private:
+    // Moves to the next window until there is a prime at pos_, or the range is done
+    void settle()
+    {
+        while (not done_ and pos_ == window_.size()) {
+            done_ = not next_window();
+        }
+    }
+
+    bool next_window()
+    {
+        window_.clear();
+        pos_ = 0;
+        while (not sieve_ or not sieve_->next()) {
+            if (next_ >= hi_) {
+                return false;
+            }
+            uint64_t end    = next_ + std::min(hi_ - next_, stage_);
+            uint64_t window = std::min(stage_, segmented_sieve::default_segment_size);
+            sieve_.emplace(next_, end, window);
+            next_  = end;
+            stage_ = std::min(2 * stage_, max_bound);
+        }
+        sieve_->for_each([&](uint64_t p) { window_.push_back(p); });
+        return true;
+    }
+
+    uint64_t                       next_  = 0; // start of the next stage
+    uint64_t                       hi_    = max_bound;
+    uint64_t                       stage_ = first_stage; // length of the next stage
+    std::optional<segmented_sieve> sieve_;
+    std::vector<uint64_t>          window_; // primes of the current window
+    size_t                         pos_  = 0;
+    bool                           done_ = false;
+};
+
+static_assert(std::ranges::input_range<prime_view> and std::ranges::view<prime_view>);
+
+// e.g. primes() | std::views::take_while([](uint64_t p) { return p < 1000; })
+inline prime_view primes(uint64_t lo = 0, uint64_t hi = prime_view::max_bound)
+{
+    return { lo, hi };
+}
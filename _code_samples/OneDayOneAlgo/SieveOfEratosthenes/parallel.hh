@@ -0,0 +1,95 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "segmented.hh"
+
+// Parallel versions of the segmented sieve: [lo, hi) is cut into chunks of a few windows and
+// every chunk gets its own segmented_sieve, so the threads only share the base primes and
+// never the crossing off offsets.
+constexpr uint64_t parallel_chunk_size = 8 * segmented_sieve::default_segment_size;
+
+inline uint64_t chunk_count(uint64_t lo, uint64_t hi)
+{
+    return hi > lo ? (hi - lo + parallel_chunk_size - 1) / parallel_chunk_size : 0;
+}
+
+// Runs sieve_chunk(c) for every chunk c of [lo, hi), chunks are handed out to the threads one
+// by one, so a thread slowed down by something else doesn't hold the others
+inline void parallel_chunks(uint64_t lo, uint64_t hi, size_t threads, auto&& sieve_chunk)
+{
+    uint64_t chunks = chunk_count(lo, hi);
+    threads         = std::clamp<uint64_t>(threads, 1, std::max<uint64_t>(chunks, 1));
+
+    std::atomic<uint64_t> next { 0 };
+    auto                  work = [&] {
+        for (uint64_t c = next++; c < chunks; c = next++) {
+            sieve_chunk(c);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < threads; ++t) {
+        workers.emplace_back(work);
+    }
+    work();
+    for (auto&& w : workers) {
+        w.join();
+    }
+}
+
+inline uint64_t parallel_count_primes(uint64_t lo,
+                                      uint64_t hi,
+                                      size_t   threads = std::thread::hardware_concurrency())
+{
+    auto                  primes = primes_up_to(segmented_sieve::base_limit(hi));
+    std::atomic<uint64_t> total { 0 };
+    parallel_chunks(lo, hi, threads, [&](uint64_t c) {
+        uint64_t        first = lo + c * parallel_chunk_size;
+        uint64_t        last  = std::min(hi, first + parallel_chunk_size);
+        segmented_sieve sieve(first, last, primes);
+        uint64_t        count = 0;
+        while (sieve.next()) {
+            count += sieve.count();
+        }
+        total += count;
+    });
+    return total;
+}
+
+// Calls f(p) for every prime lo <= p < hi, in increasing order and on the calling thread.
+// Rounds of one chunk per thread are sieved in parallel into lists of primes, then passed to
+// f in order, so memory stays bounded by threads chunks whatever the size of the range.
+inline void parallel_for_each_prime(uint64_t lo,
+                                    uint64_t hi,
+                                    auto&&   f,
+                                    size_t   threads = std::thread::hardware_concurrency())
+{
+    auto     primes = primes_up_to(segmented_sieve::base_limit(hi));
+    uint64_t chunks = chunk_count(lo, hi);
+    threads         = std::max<size_t>(threads, 1);
+
+    std::vector<std::vector<uint64_t>> found(threads);
+    for (uint64_t round = 0; round < chunks; round += threads) {
+        uint64_t round_lo = lo + round * parallel_chunk_size;
+        uint64_t round_hi = std::min<uint64_t>(hi, round_lo + threads * parallel_chunk_size);
+        parallel_chunks(round_lo, round_hi, threads, [&](uint64_t c) {
+            uint64_t        first = round_lo + c * parallel_chunk_size;
+            uint64_t        last  = std::min(round_hi, first + parallel_chunk_size);
+            segmented_sieve sieve(first, last, primes);
+            found[c].clear();
+            while (sieve.next()) {
+                sieve.for_each([&](uint64_t p) { found[c].push_back(p); });
+            }
+        });
+        for (uint64_t c = 0; c < chunk_count(round_lo, round_hi); ++c) {
+            for (uint64_t p : found[c]) {
+                f(p);
+            }
+        }
+    }
+}
@@ -1,22 +1,23 @@
-#include <chrono>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <ranges>
+#include <string>
+#include <thread>
 #include <vector>
 
-template <typename Duration>
-struct time_guard
-{
-    using clock = std::chrono::steady_clock;
-
-    time_guard(Duration& store_) : ref_time(clock::now()), store(store_) {}
-
-    ~time_guard()
-    {
-        store = std::chrono::duration_cast<Duration>(clock::now() - ref_time);
-    }
+#include <fcntl.h>
+#include <unistd.h>
 
-    clock::time_point ref_time;
-    Duration&         store;
-};
+#include "../../bench/bench.hh"
+#include "bitset.hh"
+#include "generator.hh"
+#include "parallel.hh"
+#include "prime_count.hh"
+#include "segmented.hh"
+#include "writer.hh"
 
 std::vector<bool> sieve0(size_t n)
 {
@@ -62,37 +63,122 @@ std::vector<bool> sieve2(size_t n)
     return primes;
 }
 
-void print_primes(const std::vector<bool>& primes)
+// Same as sieve2, packed: only odd numbers, one bit each, sieved window by window
+odd_bitset sieve3(size_t n)
+{
+    odd_bitset      primes(n);
+    segmented_sieve sieve(0, n + 1);
+    while (sieve.next()) {
+        std::ranges::copy(sieve.words(), primes.words().begin() + sieve.first_word());
+    }
+    return primes;
+}
+
+// Number of primes up to n through the lazy range, without ever holding all of them
+uint64_t count_lazily(uint64_t n)
 {
+    auto up_to_n = [n](uint64_t p) { return p <= n; };
+    return std::ranges::distance(primes() | std::views::take_while(up_to_n));
+}
+
+void print_primes(const std::vector<bool>& primes, int fd = STDOUT_FILENO)
+{
+    std::cout.flush();
+    bulk_writer out(fd);
     for (size_t i = 2; i < primes.size(); ++i) {
         if (primes[i]) {
-            std::cout << i << " is prime\n";
+            out.write_uint(i);
+            out.write(" is prime\n");
         }
     }
+    out.flush();
 }
 
-static constexpr size_t N = 500'000;
+enum class dump_format
+{
+    text,  // one prime per line
+    delta, // see delta_writer
+};
 
-int main()
+// Writes the primes lo <= p < hi to fd, sieving them as they are written
+void dump_primes(uint64_t lo, uint64_t hi, int fd, dump_format format)
 {
-    std::chrono::duration<double> time0;
-    {
-        time_guard clock(time0);
-        auto       primes = sieve0(N);
+    bulk_writer out(fd);
+    if (format == dump_format::text) {
+        for_each_prime(lo, hi, [&](uint64_t p) {
+            out.write_uint(p);
+            out.write("\n");
+        });
+    } else {
+        for_each_prime(lo, hi, delta_writer(out));
     }
-    std::cout << "sieve0(" << N << ") : " << time0.count() << "s\n";
+    out.flush();
+}
 
-    std::chrono::duration<double> time1;
-    {
-        time_guard clock(time1);
-        auto       primes = sieve1(N);
-    }
-    std::cout << "sieve1(" << N << ") : " << time1.count() << "s\n";
+static constexpr size_t N     = 500'000;
+static constexpr size_t big_N = 100'000'000;
 
-    std::chrono::duration<double> time2;
-    {
-        time_guard clock(time2);
-        auto       primes = sieve2(N);
+int main(int argc, char** argv)
+{
+    bench::runner runner { argc, argv };
+    auto          suffix = "(" + std::to_string(N) + ")";
+    runner.run("sieve0" + suffix, [] { return sieve0(N); }, N);
+    runner.run("sieve1" + suffix, [] { return sieve1(N); }, N);
+    runner.run("sieve2" + suffix, [] { return sieve2(N); }, N);
+    runner.run("sieve3" + suffix, [] { return sieve3(N); }, N);
+    runner.run("segmented" + suffix, [] { return count_primes(0, N + 1); }, N);
+
+    auto big_suffix = "(" + std::to_string(big_N) + ")";
+    runner.run("sieve2" + big_suffix, [] { return sieve2(big_N); }, big_N);
+    runner.run("sieve3" + big_suffix, [] { return sieve3(big_N); }, big_N);
+    runner.run("segmented" + big_suffix, [] { return count_primes(0, big_N + 1); }, big_N);
+    auto threads = std::to_string(std::thread::hardware_concurrency());
+    runner.run("parallel" + big_suffix + " on " + threads + " threads",
+               [] { return parallel_count_primes(0, big_N + 1); },
+               big_N);
+    runner.run("lazy" + big_suffix, [] { return count_lazily(big_N); }, big_N);
+    int           null_fd = ::open("/dev/null", O_WRONLY);
+    std::ofstream null_stream("/dev/null");
+    auto          iostream_dump = [&] {
+        for_each_prime(0, big_N + 1, [&](uint64_t p) { null_stream << p << "\n"; });
+    };
+    runner.run("dump iostream" + big_suffix, iostream_dump, big_N);
+    runner.run("dump text" + big_suffix,
+               [&] { dump_primes(0, big_N + 1, null_fd, dump_format::text); },
+               big_N);
+    runner.run("dump delta" + big_suffix,
+               [&] { dump_primes(0, big_N + 1, null_fd, dump_format::delta); },
+               big_N);
+    ::close(null_fd);
+    runner.run("prime_count" + big_suffix, [] { return prime_count(big_N); }, big_N);
+    constexpr uint64_t e10 = 10'000'000'000;
+    runner.run("prime_count(1e10)", [] { return prime_count(e10); }, e10);
+
+    auto packed = sieve3(big_N);
+    std::cout << "\nsieve3(" << big_N << "): " << packed.count() << " primes in "
+              << packed.bytes() << " bytes, sieve2 needs " << big_N / 8 << "\n";
+
+    auto dump_path = (std::filesystem::temp_directory_path() / "primes.delta").string();
+    int  dump_fd   = ::open(dump_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    dump_primes(0, 1'000'000, dump_fd, dump_format::delta);
+    ::close(dump_fd);
+    std::ifstream        dumped(dump_path, std::ios::binary);
+    std::vector<uint8_t> bytes(std::istreambuf_iterator<char>(dumped), {});
+    std::filesystem::remove(dump_path);
+    bool decoded = decode_deltas(bytes) == primes_in_range(0, 1'000'000);
+    std::cout << "delta dump of the primes below 1e6: " << bytes.size() << " bytes, decoded "
+              << (decoded ? "ok" : "wrong") << "\n";
+
+    std::cout << "pi(1e12) = " << prime_count(1'000'000'000'000) << "\n";
+    std::cout << "first primes from 1e12:";
+    for (uint64_t p : primes(1'000'000'000'000) | std::views::take(3)) {
+        std::cout << " " << p;
+    }
+    std::cout << "\n";
+    std::cout << "primes in [1e12, 1e12 + 200):";
+    for (uint64_t p : primes_in_range(1'000'000'000'000, 1'000'000'000'200)) {
+        std::cout << " " << p;
     }
-    std::cout << "sieve2(" << N << ") : " << time2.count() << "s\n";
+    std::cout << "\n";
+    runner.write_json();
 }
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "segmented.hh"
+
+// Number of primes p <= x, without enumerating them (Lucy_Hedgehog's method): S(v), the
+// count of numbers in [2, v] left after sieving with the primes below p, is only needed
+// for the O(sqrt(x)) values v = x / i. Sieving with p removes the numbers whose smallest
+// prime factor is p:
+//
+//   S(v) -= S(v / p) - S(p - 1)    for every v >= p * p
+//
+// Once every prime up to sqrt(x) is done, S(x) = pi(x). That is O(x^(3/4)) operations and
+// O(sqrt(x)) memory; pi(1e13) needs about 40MB.
+inline uint64_t prime_count(uint64_t x)
+{
+    if (x < 2) {
+        return 0;
+    }
+    uint64_t r = isqrt(x);
+    // small[v] = S(v) for v <= r, large[i] = S(x / i) for i <= r
+    std::vector<uint32_t> small(r + 1);
+    std::vector<uint64_t> large(r + 1);
+    for (uint64_t v = 1; v <= r; ++v) {
+        small[v] = uint32_t(v - 1);
+        large[v] = x / v - 1;
+    }
+    // Quotients are the bottleneck: below 2^52 a double division truncated gives the exact
+    // result, and is several times faster than a 64 bits integer one
+    bool fast_division = x < uint64_t(1) << 52;
+    auto quotient      = [&](uint64_t d) {
+        return fast_division ? uint64_t(double(x) / double(d)) : x / d;
+    };
+    for (uint64_t p : primes_in_range(2, r + 1)) {
+        uint32_t sp = small[p - 1]; // primes below p
+        uint64_t p2 = p * p;
+        // large values first, they read S(x / (i * p)) before it is updated
+        uint64_t last = std::min(r, x / p2);
+        for (uint64_t i = 1; i <= last; ++i) {
+            uint64_t d = i * p;
+            large[i] -= (d <= r ? large[d] : small[quotient(d)]) - sp;
+        }
+        // r < 2^32, so are these quotients
+        for (uint64_t v = r; v >= p2; --v) {
+            small[v] -= small[uint32_t(v) / uint32_t(p)] - sp;
+        }
+    }
+    return large[1];
+}
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include "bitset.hh"
+
+// Largest r such that r * r <= n
+inline uint64_t isqrt(uint64_t n)
+{
+    uint64_t r = uint64_t(std::sqrt(double(n)));
+    while (r > 0 and r > n / r) {
+        --r;
+    }
+    while (r + 1 <= n / (r + 1)) {
+        ++r;
+    }
+    return r;
+}
+
+// Primes up to n (included), with a plain sieve: only used for the small base primes
+inline std::vector<uint32_t> primes_up_to(uint32_t n)
+{
+    std::vector<char> composite(size_t(n) + 1);
+    for (uint64_t i = 2; i * i <= n; ++i) {
+        if (not composite[i]) {
+            for (uint64_t j = i * i; j <= n; j += i) {
+                composite[j] = true;
+            }
+        }
+    }
+    std::vector<uint32_t> primes;
+    for (uint64_t i = 2; i <= n; ++i) {
+        if (not composite[i]) {
+            primes.push_back(uint32_t(i));
+        }
+    }
+    return primes;
+}
+
+// Sieve of [lo, hi) one window at a time: only the primes up to sqrt(hi) and a window of
+// segment_size numbers are in memory, whatever the size of the range. Windows are packed
+// (see bitset.hh) and the default one is 256KB, sized for L2, so every base prime crosses off
+// its multiples in cache.
+class segmented_sieve
+{
+public:
+    static constexpr size_t default_segment_size = 256 * 1024 * 8 * 2;
+
+    segmented_sieve(uint64_t lo, uint64_t hi, size_t segment_size = default_segment_size) :
+      segmented_sieve(lo, hi, primes_up_to(base_limit(hi)), segment_size)
+    {
+    }
+
+    // With the base primes already known, e.g. shared by several sieves of parts of a range.
+    // primes must hold every prime up to base_limit(hi) at least.
+    segmented_sieve(uint64_t                  lo,
+                    uint64_t                  hi,
+                    std::span<const uint32_t> primes,
+                    size_t                    segment_size = default_segment_size) :
+      lo_(lo), hi_(std::max(lo, hi)), next_(lo / 128 * 64), window_((segment_size + 127) / 128)
+    {
+        if (segment_size == 0) {
+            throw std::invalid_argument("empty segment");
+        }
+        if (hi_ > uint64_t(1) << 62) {
+            throw std::invalid_argument("range too large");
+        }
+        for (uint32_t p : primes) {
+            if (uint64_t(p) * p >= hi_) {
+                break;
+            }
+            // 2 is not stored and the smallest primes are in the presieve pattern
+            if (p <= presieve_primes.back()) {
+                continue;
+            }
+            // the first odd multiple left to cross: p * p or the first one in the range
+            uint64_t first = std::max(uint64_t(p) * p, (lo + p - 1) / p * p);
+            if (first % 2 == 0) {
+                first += p;
+            }
+            base_.push_back({ p, first / 2 });
+        }
+    }
+
+    // Largest base prime needed to sieve up to hi
+    static uint32_t base_limit(uint64_t hi)
+    {
+        return uint32_t(isqrt(hi ? hi - 1 : 0));
+    }
+
+    // Sieves the next window, false once the whole range is done
+    bool next()
+    {
+        first_bit_ = next_;
+        low_       = std::max(lo_, 2 * first_bit_);
+        if (low_ >= hi_) {
+            return false;
+        }
+        next_          = first_bit_ + 64 * window_.size();
+        high_          = std::min(hi_, 2 * next_);
+        uint64_t end   = hi_ / 2; // first bit past the range
+        words_         = std::min<uint64_t>(window_.size(), (end - first_bit_ + 63) / 64);
+        uint64_t limit = first_bit_ + 64 * words_;
+
+        presieve({ window_.data(), words_ }, first_bit_ / 64);
+        if (first_bit_ == 0 and words_ != 0) {
+            window_[0] = (window_[0] | presieve_primes_mask()) & ~uint64_t(1);
+        }
+        for (auto&& b : base_) {
+            if (uint64_t(b.prime) * b.prime >= high_) {
+                break;
+            }
+            // first_bit_ is a multiple of 64, so bit i is bit i % 64 of its word
+            uint64_t i = b.next;
+            for (; i < limit; i += b.prime) {
+                window_[(i - first_bit_) / 64] &= ~(uint64_t(1) << (i % 64));
+            }
+            b.next = i;
+        }
+
+        // bits of the window outside of [lo, hi)
+        if (lo_ / 2 > first_bit_) {
+            window_[0] &= ~uint64_t(0) << (lo_ / 2 - first_bit_);
+        }
+        if (end < limit) {
+            window_[words_ - 1] &= (uint64_t(1) << (end % 64)) - 1;
+        }
+        return true;
+    }
+
+    // Bounds of the current window
+    uint64_t low() const
+    {
+        return low_;
+    }
+
+    uint64_t high() const
+    {
+        return high_;
+    }
+
+    // Calls f(p) for every prime of the current window, in increasing order
+    void for_each(auto&& f) const
+    {
+        if (low_ <= 2 and 2 < high_) {
+            f(uint64_t(2));
+        }
+        for (size_t w = 0; w != words_; ++w) {
+            for (uint64_t bits = window_[w]; bits != 0; bits &= bits - 1) {
+                f(2 * (first_bit_ + 64 * w + std::countr_zero(bits)) + 1);
+            }
+        }
+    }
+
+    size_t count() const
+    {
+        size_t count = low_ <= 2 and 2 < high_;
+        for (size_t w = 0; w != words_; ++w) {
+            count += std::popcount(window_[w]);
+        }
+        return count;
+    }
+
+    // Packed window, see bitset.hh, starting at word first_word() of the whole sieve
+    std::span<const uint64_t> words() const
+    {
+        return { window_.data(), words_ };
+    }
+
+    uint64_t first_word() const
+    {
+        return first_bit_ / 64;
+    }
+
+private:
+    struct base_prime
+    {
+        uint32_t prime;
+        uint64_t next; // bit of the next odd multiple to cross off
+    };
+
+    uint64_t                lo_;
+    uint64_t                hi_;
+    uint64_t                next_; // first bit of the next window
+    uint64_t                first_bit_ = 0;
+    uint64_t                low_       = 0;
+    uint64_t                high_      = 0;
+    std::vector<uint64_t>   window_;
+    size_t                  words_ = 0; // used in the window
+    std::vector<base_prime> base_;
+};
+
+// Calls f(p) for every prime lo <= p < hi, in increasing order
+inline void for_each_prime(uint64_t lo, uint64_t hi, auto&& f)
+{
+    segmented_sieve sieve(lo, hi);
+    while (sieve.next()) {
+        sieve.for_each(f);
+    }
+}
+
+// Primes lo <= p < hi, e.g. primes_in_range(1e12, 1e12 + 1000) only needs the primes up to
+// 1e6 and a single window
+inline std::vector<uint64_t> primes_in_range(uint64_t lo, uint64_t hi)
+{
+    std::vector<uint64_t> primes;
+    for_each_prime(lo, hi, [&](uint64_t p) { primes.push_back(p); });
+    return primes;
+}
+
+inline uint64_t count_primes(uint64_t lo, uint64_t hi)
+{
+    segmented_sieve sieve(lo, hi);
+    uint64_t        count = 0;
+    while (sieve.next()) {
+        count += sieve.count();
+    }
+    return count;
+}
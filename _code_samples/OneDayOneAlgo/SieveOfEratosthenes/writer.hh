@@ -0,0 +1,152 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include <unistd.h>
+
+// Output through a large buffer flushed with write(2), numbers formatted with std::to_chars:
+// no locale, no stream state and no virtual call per number. A writer is not shared, each
+// thread writing its own output has its own writer and buffer.
+class bulk_writer
+{
+public:
+    static constexpr size_t default_buffer_size = 1 << 20;
+
+    explicit bulk_writer(int fd, size_t buffer_size = default_buffer_size) :
+      fd_(fd), buffer_(std::max<size_t>(buffer_size, 64))
+    {
+    }
+
+    bulk_writer(const bulk_writer&)            = delete;
+    bulk_writer& operator=(const bulk_writer&) = delete;
+
+    // Errors are lost at this point, call flush() first to get them
+    ~bulk_writer()
+    {
+        try {
+            flush();
+        } catch (...) {
+        }
+    }
+
+    void write(std::string_view s)
+    {
+        if (s.size() > buffer_.size() - size_) {
+            flush();
+            if (s.size() > buffer_.size()) {
+                write_all(s.data(), s.size());
+                return;
+            }
+        }
+        std::memcpy(buffer_.data() + size_, s.data(), s.size());
+        size_ += s.size();
+    }
+
+    void write_uint(uint64_t n)
+    {
+        reserve(20);
+        auto r = std::to_chars(buffer_.data() + size_, buffer_.data() + buffer_.size(), n);
+        size_  = r.ptr - buffer_.data();
+    }
+
+    // LEB128: 7 bits per byte, low bits first, the high bit set on all bytes but the last
+    void write_varint(uint64_t n)
+    {
+        reserve(10);
+        for (; n >= 0x80; n >>= 7) {
+            buffer_[size_++] = char(n | 0x80);
+        }
+        buffer_[size_++] = char(n);
+    }
+
+    void flush()
+    {
+        write_all(buffer_.data(), size_);
+        size_ = 0;
+    }
+
+private:
+    void reserve(size_t n)
+    {
+        if (buffer_.size() - size_ < n) {
+            flush();
+        }
+    }
+
+    void write_all(const char* data, size_t size)
+    {
+        while (size != 0) {
+            ssize_t n = ::write(fd_, data, size);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::system_error(errno, std::generic_category(), "write failed");
+            }
+            data += n;
+            size -= n;
+        }
+    }
+
+    int               fd_;
+    std::vector<char> buffer_;
+    size_t            size_ = 0;
+};
+
+// Binary dump of increasing numbers: each one is written as its difference with the
+// previous one, as a varint. Prime gaps below 128 take a single byte.
+class delta_writer
+{
+public:
+    explicit delta_writer(bulk_writer& out) : out_(out) {}
+
+    void operator()(uint64_t n)
+    {
+        out_.write_varint(n - prev_);
+        prev_ = n;
+    }
+
+private:
+    bulk_writer& out_;
+    uint64_t     prev_ = 0;
+};
+
+// Numbers written by a delta_writer. Throws on a varint that doesn't fit 64 bits (more than
+// 10 bytes) or that the bytes end in the middle of.
+inline std::vector<uint64_t> decode_deltas(std::span<const uint8_t> bytes)
+{
+    std::vector<uint64_t> numbers;
+    uint64_t              n     = 0;
+    uint64_t              delta = 0;
+    int                   shift = 0;
+    for (uint8_t b : bytes) {
+        // the 10th byte only has the top bit left
+        if (shift == 63 and (b & 0x7F) > 1) {
+            throw std::invalid_argument("varint too large");
+        }
+        delta |= uint64_t(b & 0x7F) << shift;
+        shift += 7;
+        if (not(b & 0x80)) {
+            n += delta;
+            numbers.push_back(n);
+            delta = 0;
+            shift = 0;
+        } else if (shift == 70) {
+            throw std::invalid_argument("varint too long");
+        }
+    }
+    if (shift != 0) {
+        throw std::invalid_argument("truncated varint");
+    }
+    return numbers;
+}
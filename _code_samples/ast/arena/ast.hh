@@ -0,0 +1,178 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+namespace arena::ast {
+
+// Nodes are referenced by their index in the Tree, names by their index in the Symbols
+using Node_id = uint32_t;
+using Symbol  = uint32_t;
+
+// Interned strings: each distinct name is stored once and compared as an integer
+class Symbols
+{
+public:
+    // The operators come first, so they are known constants
+    static constexpr Symbol add = 0;
+    static constexpr Symbol sub = 1;
+    static constexpr Symbol mul = 2;
+    static constexpr Symbol div = 3;
+
+    Symbols()
+    {
+        for (auto op : { "+", "-", "*", "/" }) {
+            intern(op);
+        }
+    }
+
+    Symbol intern(std::string_view name)
+    {
+        if (auto it = ids_.find(name); it != ids_.end()) {
+            return it->second;
+        }
+        Symbol id = Symbol(names_.size());
+        names_.emplace_back(name);
+        ids_.emplace(names_.back(), id);
+        return id;
+    }
+
+    std::string_view name(Symbol id) const
+    {
+        return names_[id];
+    }
+
+    size_t size() const
+    {
+        return names_.size();
+    }
+
+private:
+    std::deque<std::string>                      names_; // stable addresses for the keys
+    std::unordered_map<std::string_view, Symbol> ids_;
+};
+
+struct Integer
+{
+    int value;
+
+    bool operator==(const Integer&) const = default;
+};
+
+struct Variable
+{
+    Symbol name;
+
+    bool operator==(const Variable&) const = default;
+};
+
+struct Bin_op
+{
+    Node_id lhs;
+    Node_id rhs;
+    Symbol  op;
+
+    bool operator==(const Bin_op&) const = default;
+};
+
+struct Let
+{
+    Symbol  var_name;
+    Node_id var_expr;
+    Node_id in_expr;
+
+    bool operator==(const Let&) const = default;
+};
+
+using Node = std::variant<Integer, Variable, Bin_op, Let>;
+
+static_assert(sizeof(Node) <= 16);
+
+// Owns every node of one or more expressions in a single vector: building is an append,
+// children are 32 bits indices rather than pointers, and the whole tree goes away at once.
+class Tree
+{
+public:
+    Node_id integer(int value)
+    {
+        return add(Integer { value });
+    }
+
+    Node_id variable(std::string_view name)
+    {
+        return add(Variable { symbols_.intern(name) });
+    }
+
+    Node_id bin_op(Node_id lhs, Node_id rhs, std::string_view op)
+    {
+        return add(Bin_op { lhs, rhs, symbols_.intern(op) });
+    }
+
+    Node_id let(std::string_view var, Node_id var_expr, Node_id in_expr)
+    {
+        return add(Let { symbols_.intern(var), var_expr, in_expr });
+    }
+
+    const Node& operator[](Node_id id) const
+    {
+        return nodes_[id];
+    }
+
+    std::string_view name(Symbol id) const
+    {
+        return symbols_.name(id);
+    }
+
+    Symbols& symbols()
+    {
+        return symbols_;
+    }
+
+    const Symbols& symbols() const
+    {
+        return symbols_;
+    }
+
+    size_t size() const
+    {
+        return nodes_.size();
+    }
+
+    size_t bytes() const
+    {
+        return nodes_.capacity() * sizeof(Node);
+    }
+
+    void reserve(size_t nodes)
+    {
+        nodes_.reserve(nodes);
+    }
+
+    // Appends a node whose children are already in the tree
+    Node_id add(Node node)
+    {
+        if (nodes_.size() >= UINT32_MAX) {
+            throw std::length_error("too many nodes");
+        }
+        nodes_.push_back(node);
+        return Node_id(nodes_.size() - 1);
+    }
+
+    // Frees every node at once, the symbols are kept
+    void clear()
+    {
+        nodes_.clear();
+    }
+
+private:
+    std::vector<Node> nodes_;
+    Symbols           symbols_;
+};
+
+};
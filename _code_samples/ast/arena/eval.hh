@@ -0,0 +1,129 @@
+#pragma once
+
+#include <exception>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <variant>
+
+#include "ast.hh"
+
+namespace arena::ast {
+
+struct Pretty_printer
+{
+    void operator()(const Integer& i)
+    {
+        std::cout << i.value;
+    }
+
+    void operator()(const Variable& var)
+    {
+        std::cout << tree.name(var.name);
+    }
+
+    void operator()(const Bin_op& bop)
+    {
+        std::cout << "(";
+        std::visit(*this, tree[bop.lhs]);
+        std::cout << " " << tree.name(bop.op) << " ";
+        std::visit(*this, tree[bop.rhs]);
+        std::cout << ")";
+    }
+
+    void operator()(const Let& let)
+    {
+        std::cout << "let " << tree.name(let.var_name) << " = ";
+        std::visit(*this, tree[let.var_expr]);
+        std::cout << " in ";
+        std::visit(*this, tree[let.in_expr]);
+    }
+
+    const Tree& tree;
+};
+
+struct Undefined_variable : public std::exception
+{
+    Undefined_variable(std::string_view v) : msg(std::string("unknown variable ") += v) {}
+
+    const char* what() const noexcept override
+    {
+        return msg.c_str();
+    }
+
+    std::string msg;
+};
+
+struct Undefined_operator : public std::exception
+{
+    Undefined_operator(std::string_view v) : msg(std::string("unknown operator ") += v) {}
+
+    const char* what() const noexcept override
+    {
+        return msg.c_str();
+    }
+
+    std::string msg;
+};
+
+// Operators are interned first, no string comparison here
+inline int apply(const Tree& tree, Symbol op, int lhs, int rhs)
+{
+    switch (op) {
+    case Symbols::add:
+        return lhs + rhs;
+    case Symbols::sub:
+        return lhs - rhs;
+    case Symbols::mul:
+        return lhs * rhs;
+    case Symbols::div:
+        return lhs / rhs;
+    }
+    throw Undefined_operator(tree.name(op));
+}
+
+struct Eval
+{
+    Eval(const Tree& t) : tree(t) {}
+
+    void operator()(const Integer& i)
+    {
+        res = i.value;
+    }
+
+    void operator()(const Variable& var)
+    {
+        auto it = env.find(var.name);
+        if (it == env.end()) {
+            throw Undefined_variable(tree.name(var.name));
+        }
+        res = it->second;
+    }
+
+    void operator()(const Bin_op& bop)
+    {
+        std::visit(*this, tree[bop.lhs]);
+        int lres = res;
+        std::visit(*this, tree[bop.rhs]);
+        res = apply(tree, bop.op, lres, res);
+    }
+
+    void operator()(const Let& let)
+    {
+        std::visit(*this, tree[let.var_expr]);
+        env[let.var_name] = res;
+
+        Eval sub(*this);
+        std::visit(sub, tree[let.in_expr]);
+        res = sub.res;
+    }
+
+    const Tree& tree;
+
+    int res = 0;
+
+    std::unordered_map<Symbol, int> env;
+};
+
+};
@@ -0,0 +1,267 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+#include "ast.hh"
+#include "eval.hh"
+
+namespace arena::ast {
+
+// Hash of the fields of a node, children included as ids and not looked into
+struct Node_hash
+{
+    static std::array<uint32_t, 3> fields(const Integer& i)
+    {
+        return { uint32_t(i.value), 0, 0 };
+    }
+
+    static std::array<uint32_t, 3> fields(const Variable& var)
+    {
+        return { var.name, 0, 0 };
+    }
+
+    static std::array<uint32_t, 3> fields(const Bin_op& bop)
+    {
+        return { bop.lhs, bop.rhs, bop.op };
+    }
+
+    static std::array<uint32_t, 3> fields(const Let& let)
+    {
+        return { let.var_name, let.var_expr, let.in_expr };
+    }
+
+    size_t operator()(const Node& node) const
+    {
+        uint64_t h = node.index();
+        for (uint32_t field : std::visit([](const auto& n) { return fields(n); }, node)) {
+            h = (h ^ field) * 0x9E3779B97F4A7C15;
+            h ^= h >> 32;
+        }
+        return h;
+    }
+};
+
+// Builds expressions into a Tree where structurally equal subtrees are a single node. The
+// children of a new node are unique already, so finding an equal node only compares its
+// own fields. Expressions become DAGs, which anything following ids through a Tree reads
+// unchanged, only faster with Memo_eval.
+class Hash_consed_tree
+{
+public:
+    Node_id integer(int value)
+    {
+        return intern(Integer { value });
+    }
+
+    Node_id variable(std::string_view name)
+    {
+        return intern(Variable { tree_.symbols().intern(name) });
+    }
+
+    Node_id bin_op(Node_id lhs, Node_id rhs, std::string_view op)
+    {
+        return intern(Bin_op { lhs, rhs, tree_.symbols().intern(op) });
+    }
+
+    Node_id let(std::string_view var, Node_id var_expr, Node_id in_expr)
+    {
+        return intern(Let { tree_.symbols().intern(var), var_expr, in_expr });
+    }
+
+    const Tree& tree() const
+    {
+        return tree_;
+    }
+
+    Symbols& symbols()
+    {
+        return tree_.symbols();
+    }
+
+    // Nodes asked for that already existed
+    size_t shared() const
+    {
+        return shared_;
+    }
+
+    void clear()
+    {
+        tree_.clear();
+        ids_.clear();
+        shared_ = 0;
+    }
+
+private:
+    Node_id intern(Node node)
+    {
+        auto [it, inserted] = ids_.try_emplace(node, Node_id(tree_.size()));
+        if (inserted) {
+            tree_.add(node);
+        } else {
+            ++shared_;
+        }
+        return it->second;
+    }
+
+    Tree                                         tree_;
+    std::unordered_map<Node, Node_id, Node_hash> ids_;
+    size_t                                       shared_ = 0;
+};
+
+// Evaluates every distinct subtree once per run, however often the expression uses it.
+// Variables are bound lexically, and each let binding of a run gets a new serial number,
+// the inputs 0. A result is reused while the free variables of its subtree have the same
+// bindings: as lets nest, that is while the most recent of those bindings is the same.
+// The tree may grow between runs, but once it is cleared it needs a new Memo_eval.
+class Memo_eval
+{
+public:
+    explicit Memo_eval(const Tree& tree) : tree_(tree) {}
+
+    int run(Node_id root, const std::unordered_map<Symbol, int>& inputs = {})
+    {
+        update();
+        if (++run_ == 0) {
+            for (auto&& info : info_) {
+                info.run = 0;
+            }
+            run_ = 1;
+        }
+        serial_   = 0;
+        computed_ = 0;
+        std::ranges::fill(bindings_, Binding {});
+        for (auto [name, value] : inputs) {
+            bindings_[name] = { value, 0, true };
+        }
+        return eval(root);
+    }
+
+    // Operations and lets computed by the last run, the others came from the memo
+    size_t computed() const
+    {
+        return computed_;
+    }
+
+private:
+    struct Binding
+    {
+        int      value  = 0;
+        uint32_t serial = 0;
+        bool     bound  = false;
+    };
+
+    // What the runs need about each node, in one place
+    struct Info
+    {
+        uint32_t parents = 0;
+        uint32_t free_begin; // free variables, in free_
+        uint32_t free_end;
+        uint32_t run    = 0; // of the memoized value
+        uint32_t serial = 0;
+        int      value  = 0;
+    };
+
+    // Catches up with the nodes added to the tree, whose children come before them
+    void update()
+    {
+        bindings_.resize(tree_.symbols().size());
+        std::vector<Symbol> free;
+        std::vector<Symbol> body;
+        for (Node_id id = Node_id(info_.size()); id != tree_.size(); ++id) {
+            auto&& node = tree_[id];
+            free.clear();
+            if (auto* var = std::get_if<Variable>(&node)) {
+                free.push_back(var->name);
+            } else if (auto* bop = std::get_if<Bin_op>(&node)) {
+                auto lhs = free_of(bop->lhs);
+                std::ranges::set_union(lhs, free_of(bop->rhs), back_inserter(free));
+                ++info_[bop->lhs].parents;
+                ++info_[bop->rhs].parents;
+            } else if (auto* let = std::get_if<Let>(&node)) {
+                auto in_free = free_of(let->in_expr);
+                body.assign(in_free.begin(), in_free.end());
+                std::erase(body, let->var_name);
+                std::ranges::set_union(free_of(let->var_expr), body, back_inserter(free));
+                ++info_[let->var_expr].parents;
+                ++info_[let->in_expr].parents;
+            }
+            auto begin = uint32_t(free_.size());
+            free_.insert(free_.end(), free.begin(), free.end());
+            info_.push_back({ .free_begin = begin, .free_end = uint32_t(free_.size()) });
+        }
+    }
+
+    std::span<const Symbol> free_of(Node_id id) const
+    {
+        return { free_.data() + info_[id].free_begin, free_.data() + info_[id].free_end };
+    }
+
+    // Serial of the most recent binding of the free variables of id
+    uint32_t stamp(Node_id id) const
+    {
+        uint32_t serial = 0;
+        for (Symbol name : free_of(id)) {
+            serial = std::max(serial, bindings_[name].serial);
+        }
+        return serial;
+    }
+
+    int eval(Node_id id)
+    {
+        auto&& node = tree_[id];
+        if (auto* i = std::get_if<Integer>(&node)) {
+            return i->value;
+        }
+        if (auto* var = std::get_if<Variable>(&node)) {
+            if (not bindings_[var->name].bound) {
+                throw Undefined_variable(tree_.name(var->name));
+            }
+            return bindings_[var->name].value;
+        }
+        // a node with a single parent is only reached again when that parent is computed
+        // again, there is nothing to look up
+        bool     shared = info_[id].parents > 1;
+        uint32_t serial = shared ? stamp(id) : 0;
+        if (shared and info_[id].run == run_ and info_[id].serial == serial) {
+            return info_[id].value;
+        }
+        int value;
+        if (auto* bop = std::get_if<Bin_op>(&node)) {
+            int lhs = eval(bop->lhs);
+            value   = apply(tree_, bop->op, lhs, eval(bop->rhs));
+        } else {
+            auto& let   = std::get<Let>(node);
+            int   bound = eval(let.var_expr);
+            auto  outer = bindings_[let.var_name];
+            bindings_[let.var_name] = { bound, ++serial_, true };
+            value                   = eval(let.in_expr);
+            bindings_[let.var_name] = outer;
+        }
+        if (shared) {
+            info_[id].run    = run_;
+            info_[id].serial = serial;
+            info_[id].value  = value;
+        }
+        ++computed_;
+        return value;
+    }
+
+    const Tree&          tree_;
+    std::vector<Info>    info_;
+    std::vector<Symbol>  free_;     // free variables of each node, sorted
+    std::vector<Binding> bindings_; // innermost binding of each symbol
+    uint32_t             run_      = 0;
+    uint32_t             serial_   = 0;
+    size_t               computed_ = 0;
+};
+
+};
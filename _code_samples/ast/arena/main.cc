@@ -0,0 +1,143 @@
+#include <chrono>
+#include <random>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+#include "../../bench/time_guard.hh"
+#include "ast.hh"
+#include "eval.hh"
+#include "hash_cons.hh"
+
+using namespace arena::ast;
+
+// Balanced sum of the variables x0 ... x(n-1), into a Tree or a Hash_consed_tree
+template <typename Builder>
+Node_id sum(Builder& tree, size_t first, size_t last)
+{
+    if (last - first == 1) {
+        return tree.variable(std::string("x") += std::to_string(first % 16));
+    }
+    size_t mid = first + (last - first) / 2;
+    Node_id lhs = sum(tree, first, mid);
+    return tree.bin_op(lhs, sum(tree, mid, last), "+");
+}
+
+// Sum of count generated rules, each combining terms out of a small pool such as
+// ((x3 + 2) * (x7 + 0)) - (x1 + 3), all within let x0 = 0 in ... let x15 = 15 in
+template <typename Builder>
+Node_id rule_set(Builder& tree, size_t count)
+{
+    std::mt19937 rng(1);
+    auto         term = [&] {
+        Node_id var = tree.variable(std::string("x") += std::to_string(rng() % 16));
+        return tree.bin_op(var, tree.integer(int(rng() % 4)), "+");
+    };
+    std::vector<Node_id> rules;
+    for (size_t i = 0; i != count; ++i) {
+        Node_id lhs     = term();
+        Node_id product = tree.bin_op(lhs, term(), "*");
+        rules.push_back(tree.bin_op(product, term(), "-"));
+    }
+    while (rules.size() > 1) {
+        std::vector<Node_id> sums;
+        for (size_t i = 0; i + 1 < rules.size(); i += 2) {
+            sums.push_back(tree.bin_op(rules[i], rules[i + 1], "+"));
+        }
+        if (rules.size() % 2) {
+            sums.push_back(rules.back());
+        }
+        rules = std::move(sums);
+    }
+    Node_id expr = rules.front();
+    for (int i = 15; i >= 0; --i) {
+        expr = tree.let(std::string("x") += std::to_string(i), tree.integer(i), expr);
+    }
+    return expr;
+}
+
+int main()
+{
+    Tree tree;
+    auto sum3 = tree.bin_op(tree.integer(1), tree.integer(2), "+");
+    auto expr = tree.let("x", tree.integer(3), tree.bin_op(sum3, tree.variable("x"), "+"));
+    Pretty_printer pretty_printer { tree };
+    std::visit(pretty_printer, tree[expr]);
+    std::cout << "\n";
+
+    Eval eval { tree };
+    std::visit(eval, tree[expr]);
+    std::cout << eval.res << std::endl;
+
+    // A million nodes: a single growing vector rather than a million allocations
+    std::chrono::microseconds build_time;
+    Tree                      big;
+    Node_id                   big_expr;
+    {
+        time_guard clock { build_time };
+        big_expr = sum(big, 0, 1 << 19);
+        for (int i = 0; i != 16; ++i) {
+            auto name = std::string("x") += std::to_string(i);
+            big_expr  = big.let(name, big.integer(i), big_expr);
+        }
+    }
+    std::chrono::microseconds eval_time;
+    Eval                      big_eval { big };
+    {
+        time_guard clock { eval_time };
+        std::visit(big_eval, big[big_expr]);
+    }
+    std::cout << big.size() << " nodes in " << big.bytes() << " bytes, built in "
+              << build_time.count() << "us, evaluated to " << big_eval.res << " in "
+              << eval_time.count() << "us\n";
+
+    // The same sum hash-consed: x0 ... x15 repeat, so do all the sums above them
+    Hash_consed_tree shared;
+    Node_id          shared_expr;
+    {
+        time_guard clock { build_time };
+        shared_expr = sum(shared, 0, 1 << 19);
+        for (int i = 0; i != 16; ++i) {
+            auto name   = std::string("x") += std::to_string(i);
+            shared_expr = shared.let(name, shared.integer(i), shared_expr);
+        }
+    }
+    Memo_eval memo_eval { shared.tree() };
+    int       shared_res;
+    {
+        time_guard clock { eval_time };
+        shared_res = memo_eval.run(shared_expr);
+    }
+    std::cout << "hash-consed: " << shared.tree().size() << " nodes (" << shared.shared()
+              << " shared), built in " << build_time.count() << "us, evaluated to "
+              << shared_res << " in " << eval_time.count() << "us\n";
+
+    constexpr size_t rule_count = 100'000;
+    Tree             rules;
+    Node_id          rules_expr = rule_set(rules, rule_count);
+    Eval             rules_eval { rules };
+    {
+        time_guard clock { eval_time };
+        std::visit(rules_eval, rules[rules_expr]);
+    }
+    std::cout << "\n" << rule_count << " rules: " << rules.size() << " nodes, evaluated to "
+              << rules_eval.res << " in " << eval_time.count() << "us\n";
+    Hash_consed_tree shared_rules;
+    Node_id          shared_rules_expr = rule_set(shared_rules, rule_count);
+    Memo_eval        rules_memo_eval { shared_rules.tree() };
+    std::chrono::microseconds first_time;
+    {
+        time_guard clock { first_time };
+        rules_memo_eval.run(shared_rules_expr);
+    }
+    {
+        time_guard clock { eval_time };
+        shared_res = rules_memo_eval.run(shared_rules_expr);
+    }
+    std::cout << "hash-consed: " << shared_rules.tree().size() << " nodes, "
+              << rules_memo_eval.computed() << " computed, evaluated to " << shared_res
+              << " in " << eval_time.count() << "us, " << first_time.count()
+              << "us the first time\n";
+}
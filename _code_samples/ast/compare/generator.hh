@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+
+// Random expressions, identical for every AST representation: Builder provides the builder
+// functions (integer, variable, bin_op and let) of a representation and its node type Ptr.
+enum class Shape
+{
+    wide, // random split of the nodes between the operands, the depth is O(log(nodes))
+    deep, // left-deep chain of operations, the depth is about nodes / 2
+};
+
+struct Tree_params
+{
+    size_t   nodes     = 1'000'000;
+    Shape    shape     = Shape::wide;
+    int      variables = 8;    // free variables x0 ... x(variables - 1)
+    double   let_ratio = 0.05; // part of the inner nodes binding one of them again
+    uint32_t seed      = 42;
+};
+
+// Inner nodes are + and -, so values grow slowly and nothing divides by 0.
+// Leaves are integers in [-9, 9] or variables.
+template <typename Builder>
+class Random_tree
+{
+public:
+    using Ptr = typename Builder::Ptr;
+
+    // params.nodes rounded up to an odd number
+    static size_t nodes(const Tree_params& params)
+    {
+        return params.nodes | 1;
+    }
+
+    static Ptr build(const Tree_params& params)
+    {
+        Random_tree tree { params, std::mt19937(params.seed) };
+        return tree.node(nodes(params));
+    }
+
+private:
+    Random_tree(const Tree_params& params, std::mt19937 rng) : params_(params), rng_(rng) {}
+
+    std::string variable_name()
+    {
+        return "x" + std::to_string(rng_() % params_.variables);
+    }
+
+    // operands are built in order, so that the random sequence doesn't depend on the
+    // evaluation order of the arguments
+    Ptr node(size_t size)
+    {
+        if (size == 1) {
+            if (rng_() % 2 == 0) {
+                return Builder::integer(int(rng_() % 19) - 9);
+            }
+            return Builder::variable(variable_name());
+        }
+        // both operands have an odd size, as every tree of binary nodes
+        size_t rest = size - 1;
+        size_t lhs  = params_.shape == Shape::deep ? rest - 1 : 1 + 2 * (rng_() % (rest / 2));
+        if (std::uniform_real_distribution<>()(rng_) < params_.let_ratio) {
+            auto name     = variable_name();
+            auto var_expr = node(rest - lhs);
+            auto in_expr  = node(lhs);
+            return Builder::let(std::move(name), std::move(var_expr), std::move(in_expr));
+        }
+        auto l = node(lhs);
+        auto r = node(rest - lhs);
+        return Builder::bin_op(std::move(l), std::move(r), rng_() % 2 ? "+" : "-");
+    }
+
+    const Tree_params& params_;
+    std::mt19937       rng_;
+};
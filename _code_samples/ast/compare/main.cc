@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <variant>
+
+#include <malloc.h>
+
+#include "../../bench/bench.hh"
+#include "../variant/ast.hh"
+#include "../variant/eval.hh"
+#include "../virtual/ast.hh"
+#include "../virtual/eval.hh"
+#include "generator.hh"
+
+// Every allocation of the program is counted, to measure what a tree costs in memory. Bytes
+// are those malloc really reserves for each block, which is what the process pays for.
+namespace {
+
+struct Alloc_stats
+{
+    size_t allocations = 0;
+    size_t bytes       = 0; // live
+    size_t peak        = 0; // since the last reset_peak()
+
+    void reset_peak()
+    {
+        peak = bytes;
+    }
+};
+
+Alloc_stats alloc_stats;
+
+}
+
+void* operator new(size_t size)
+{
+    void* p = std::malloc(size);
+    if (not p) {
+        throw std::bad_alloc();
+    }
+    alloc_stats.allocations += 1;
+    alloc_stats.bytes += malloc_usable_size(p);
+    alloc_stats.peak = std::max(alloc_stats.peak, alloc_stats.bytes);
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    if (p) {
+        alloc_stats.bytes -= malloc_usable_size(p);
+        std::free(p);
+    }
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    operator delete(p);
+}
+
+struct Variant_builder
+{
+    using Ptr = std::unique_ptr<variant::ast::Node>;
+
+    static Ptr integer(int value)
+    {
+        return variant::ast::integer(value);
+    }
+
+    static Ptr variable(std::string name)
+    {
+        return variant::ast::variable(std::move(name));
+    }
+
+    static Ptr bin_op(Ptr lhs, Ptr rhs, std::string op)
+    {
+        return variant::ast::bin_op(std::move(lhs), std::move(rhs), std::move(op));
+    }
+
+    static Ptr let(std::string name, Ptr var_expr, Ptr in_expr)
+    {
+        return variant::ast::let(std::move(name), std::move(var_expr), std::move(in_expr));
+    }
+};
+
+struct Virtual_builder
+{
+    using Ptr = std::unique_ptr<inheritance::ast::Node>;
+
+    static Ptr integer(int value)
+    {
+        return inheritance::ast::integer(value);
+    }
+
+    static Ptr variable(std::string name)
+    {
+        return inheritance::ast::variable(std::move(name));
+    }
+
+    static Ptr bin_op(Ptr lhs, Ptr rhs, std::string op)
+    {
+        return inheritance::ast::bin_op(std::move(lhs), std::move(rhs), std::move(op));
+    }
+
+    static Ptr let(std::string name, Ptr var_expr, Ptr in_expr)
+    {
+        return inheritance::ast::let(std::move(name), std::move(var_expr), std::move(in_expr));
+    }
+};
+
+void print(std::ostream& out, const variant::ast::Node& node)
+{
+    variant::ast::Pretty_printer printer { out };
+    std::visit(printer, node);
+}
+
+void print(std::ostream& out, inheritance::ast::Node& node)
+{
+    inheritance::ast::Pretty_printer printer { out };
+    node.accept(&printer);
+}
+
+int eval(const variant::ast::Node& node, const Tree_params& params)
+{
+    variant::ast::Eval eval {};
+    for (int i = 0; i != params.variables; ++i) {
+        eval.env["x" + std::to_string(i)] = i;
+    }
+    std::visit(eval, node);
+    return eval.res;
+}
+
+int eval(inheritance::ast::Node& node, const Tree_params& params)
+{
+    inheritance::ast::Eval eval {};
+    for (int i = 0; i != params.variables; ++i) {
+        eval.env["x" + std::to_string(i)] = i;
+    }
+    node.accept(&eval);
+    return eval.res;
+}
+
+size_t env_size(const char* name, size_t fallback)
+{
+    const char* value = std::getenv(name);
+    return value ? std::stoul(value) : fallback;
+}
+
+// Same random tree in both representations: prints its memory and the peak memory of
+// printing and evaluating it, then times building and freeing it, printing it to a string,
+// and evaluating it
+template <typename Builder>
+void compare(bench::runner& runner, const std::string& name, const Tree_params& params)
+{
+    using Tree = Random_tree<Builder>;
+
+    alloc_stats.reset_peak();
+    size_t before_bytes       = alloc_stats.bytes;
+    size_t before_allocations = alloc_stats.allocations;
+    auto   tree               = Tree::build(params);
+    size_t bytes              = alloc_stats.bytes - before_bytes;
+    std::printf("%-20s %10zu allocations %12zu bytes (%5.1f per node), peak %12zu bytes\n",
+                name.c_str(),
+                alloc_stats.allocations - before_allocations,
+                bytes,
+                double(bytes) / Tree::nodes(params),
+                alloc_stats.peak - before_bytes);
+
+    // memory taken at most by one print, output included, and by one evaluation
+    std::ostringstream out;
+    auto               peak_of = [](auto&& fn) {
+        alloc_stats.reset_peak();
+        size_t before = alloc_stats.bytes;
+        fn();
+        return alloc_stats.peak - before;
+    };
+    size_t print_peak = peak_of([&] { print(out, *tree); });
+    size_t eval_peak  = peak_of([&] { bench::do_not_optimize(eval(*tree, params)); });
+    std::printf("%-20s print peak %12zu bytes, eval peak %12zu bytes\n",
+                name.c_str(),
+                print_peak,
+                eval_peak);
+
+    size_t nodes = Tree::nodes(params);
+    runner.run(name + " build+free", [&] { return Tree::build(params) != nullptr; }, nodes);
+    runner.run(
+        name + " print",
+        [&] {
+            out.str({});
+            print(out, *tree);
+            return out.tellp();
+        },
+        nodes);
+    runner.run(name + " eval", [&] { return eval(*tree, params); }, nodes);
+}
+
+// Tree sizes come from AST_WIDE_NODES and AST_DEEP_NODES. Deep trees are kept small enough
+// for the recursion of the visitors, and of the destructors, on the default stack.
+int main(int argc, char** argv)
+{
+    bench::runner runner { argc, argv };
+
+    Tree_params wide { .nodes = env_size("AST_WIDE_NODES", 1'000'000), .shape = Shape::wide };
+    Tree_params deep { .nodes = env_size("AST_DEEP_NODES", 10'000), .shape = Shape::deep };
+    std::ostringstream a, b;
+    print(a, *Random_tree<Variant_builder>::build({ .nodes = 20 }));
+    print(b, *Random_tree<Virtual_builder>::build({ .nodes = 20 }));
+    std::cout << a.str() << (a.str() == b.str() ? "\n" : " differs from\n" + b.str() + "\n");
+
+    compare<Variant_builder>(runner, "variant wide", wide);
+    compare<Virtual_builder>(runner, "virtual wide", wide);
+    compare<Variant_builder>(runner, "variant deep", deep);
+    compare<Virtual_builder>(runner, "virtual deep", deep);
+    runner.write_json();
+}
@@ -27,6 +27,9 @@ struct Variable
 {
     Variable(std::string v) : name(std::move(v)) {}
     std::string name;
+
+    // de Bruijn index, set by Scope_resolver
+    int index = -1;
 };
 
 std::unique_ptr<Node> variable(std::string var)
@@ -0,0 +1,247 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+#include "ast.hh"
+#include "eval.hh"
+
+namespace variant::ast {
+
+// Expressions lowered to code for a stack machine: operators and variables are resolved
+// once by the compiler, running the code never compares or hashes a string.
+enum class Opcode : uint8_t
+{
+    push,  // pushes arg
+    input, // pushes input number arg
+    load,  // pushes slot arg
+    store, // pops into slot arg
+    add,
+    sub,
+    mul,
+    div,
+    ret, // returns the top of the stack
+};
+
+inline Opcode opcode(const std::string& op)
+{
+    if (op == "+") {
+        return Opcode::add;
+    }
+    if (op == "-") {
+        return Opcode::sub;
+    }
+    if (op == "*") {
+        return Opcode::mul;
+    }
+    if (op == "/") {
+        return Opcode::div;
+    }
+    throw Undefined_operator(op);
+}
+
+struct Instr
+{
+    Opcode op;
+    int    arg = 0;
+};
+
+struct Program
+{
+    std::vector<Instr>       code;
+    std::vector<std::string> inputs;    // free variables, in input order
+    size_t                   slots = 0; // let bound variables live at the same time
+    size_t                   stack = 0; // maximal depth of the stack
+};
+
+// Each let gets the slot of its nesting depth, and variables are bound lexically. Variables
+// no let binds are the inputs of the program.
+class Compiler
+{
+public:
+    static Program compile(const Node& node)
+    {
+        Compiler compiler;
+        std::visit(compiler, node);
+        compiler.emit({ Opcode::ret }, 0);
+        return std::move(compiler.program_);
+    }
+
+    void operator()(const Integer& i)
+    {
+        emit({ Opcode::push, i.value }, 1);
+    }
+
+    void operator()(const Variable& var)
+    {
+        auto bound = std::find(scopes_.rbegin(), scopes_.rend(), var.name);
+        if (bound != scopes_.rend()) {
+            emit({ Opcode::load, int(scopes_.rend() - bound - 1) }, 1);
+            return;
+        }
+        auto&& inputs = program_.inputs;
+        auto   input  = std::find(inputs.begin(), inputs.end(), var.name);
+        if (input == inputs.end()) {
+            input = inputs.insert(input, var.name);
+        }
+        emit({ Opcode::input, int(input - inputs.begin()) }, 1);
+    }
+
+    void operator()(const Bin_op& bop)
+    {
+        std::visit(*this, *bop.lhs);
+        std::visit(*this, *bop.rhs);
+        emit({ opcode(bop.op) }, -1);
+    }
+
+    void operator()(const Let& let)
+    {
+        std::visit(*this, *let.var_expr);
+        emit({ Opcode::store, int(scopes_.size()) }, -1);
+        scopes_.push_back(let.var_name);
+        program_.slots = std::max(program_.slots, scopes_.size());
+        std::visit(*this, *let.in_expr);
+        scopes_.pop_back();
+    }
+
+private:
+    // depth is the change of the stack depth
+    void emit(Instr instr, int depth)
+    {
+        program_.code.push_back(instr);
+        depth_ += depth;
+        program_.stack = std::max(program_.stack, depth_);
+    }
+
+    Program                  program_;
+    std::vector<std::string> scopes_; // let bound variables, innermost last
+    size_t                   depth_ = 0;
+};
+
+// Runs programs, keeping its stack and slots from one run to the next
+class Vm
+{
+public:
+    int run(const Program& program, std::span<const int> inputs = {})
+    {
+        if (inputs.size() < program.inputs.size()) {
+            throw std::invalid_argument("missing inputs");
+        }
+        stack_.resize(std::max(stack_.size(), program.stack));
+        slots_.resize(std::max(slots_.size(), program.slots));
+        return exec(program.code.data(), inputs.data(), stack_.data(), slots_.data());
+    }
+
+    // Inputs looked up by name
+    int run(const Program& program, const std::unordered_map<std::string, int>& env)
+    {
+        inputs_.clear();
+        for (auto&& name : program.inputs) {
+            auto it = env.find(name);
+            if (it == env.end()) {
+                throw Undefined_variable(name);
+            }
+            inputs_.push_back(it->second);
+        }
+        return run(program, inputs_);
+    }
+
+private:
+// With GCC and clang each instruction jumps straight to the next one through a table of
+// label addresses (computed goto), which predicts better than a single switch.
+#if defined(__GNUC__)
+#define AST_THREADED_DISPATCH 1
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#else
+#define AST_THREADED_DISPATCH 0
+#endif
+
+    static int exec(const Instr* pc, const int* inputs, int* sp, int* slots)
+    {
+#if AST_THREADED_DISPATCH
+        static void* const labels[] = { &&push, &&input, &&load, &&store, &&add,
+                                        &&sub,  &&mul,   &&div,  &&ret };
+#define AST_OP(name) name:
+#define AST_NEXT goto* labels[size_t((pc++)->op)]
+        AST_NEXT;
+#else
+#define AST_OP(name) case Opcode::name:
+#define AST_NEXT continue
+        for (;;) {
+            switch ((pc++)->op) {
+#endif
+        AST_OP(push)
+        {
+            *sp++ = pc[-1].arg;
+            AST_NEXT;
+        }
+        AST_OP(input)
+        {
+            *sp++ = inputs[pc[-1].arg];
+            AST_NEXT;
+        }
+        AST_OP(load)
+        {
+            *sp++ = slots[pc[-1].arg];
+            AST_NEXT;
+        }
+        AST_OP(store)
+        {
+            slots[pc[-1].arg] = *--sp;
+            AST_NEXT;
+        }
+        AST_OP(add)
+        {
+            --sp;
+            sp[-1] += sp[0];
+            AST_NEXT;
+        }
+        AST_OP(sub)
+        {
+            --sp;
+            sp[-1] -= sp[0];
+            AST_NEXT;
+        }
+        AST_OP(mul)
+        {
+            --sp;
+            sp[-1] *= sp[0];
+            AST_NEXT;
+        }
+        AST_OP(div)
+        {
+            --sp;
+            sp[-1] /= sp[0];
+            AST_NEXT;
+        }
+        AST_OP(ret)
+        {
+            return sp[-1];
+        }
+#if not AST_THREADED_DISPATCH
+            }
+        }
+#endif
+#undef AST_OP
+#undef AST_NEXT
+    }
+
+#if AST_THREADED_DISPATCH
+#pragma GCC diagnostic pop
+#endif
+#undef AST_THREADED_DISPATCH
+
+    std::vector<int> stack_;
+    std::vector<int> slots_;
+    std::vector<int> inputs_;
+};
+
+};
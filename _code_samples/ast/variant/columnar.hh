@@ -0,0 +1,299 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "ast.hh"
+#include "bytecode.hh"
+#include "eval.hh"
+#include "fold.hh"
+
+namespace variant::ast {
+
+// Struct of arrays: a column of values per variable, one row per environment. Columns are
+// views on the caller's storage.
+class Table
+{
+public:
+    explicit Table(size_t rows) : rows_(rows) {}
+
+    void add(std::string name, std::span<const int> column)
+    {
+        if (column.size() != rows_) {
+            throw std::invalid_argument("column " + name + " doesn't have "
+                                        + std::to_string(rows_) + " rows");
+        }
+        columns_.insert_or_assign(std::move(name), column);
+    }
+
+    std::span<const int> column(const std::string& name) const
+    {
+        auto it = columns_.find(name);
+        if (it == columns_.end()) {
+            throw Undefined_variable(name);
+        }
+        return it->second;
+    }
+
+    size_t rows() const
+    {
+        return rows_;
+    }
+
+private:
+    size_t                                                rows_;
+    std::unordered_map<std::string, std::span<const int>> columns_;
+};
+
+// Evaluates an expression for every row of a Table at once. The expression is lowered to a
+// list of operations on columns, each one a loop over a chunk of rows the compiler turns
+// into SIMD code (but division, which x86 has no vector instruction for). Chunks are small
+// enough for all their temporary columns to stay in L1. Lets cost nothing, a variable is
+// the column of its value.
+class Column_eval
+{
+public:
+    static constexpr size_t chunk_size = 1024;
+
+    explicit Column_eval(const Node& node)
+    {
+        result_ = std::visit(*this, node);
+    }
+
+    std::vector<int> run(const Table& table)
+    {
+        std::vector<int> result(table.rows());
+        run(table, result);
+        return result;
+    }
+
+    void run(const Table& table, std::span<int> result)
+    {
+        if (result.size() != table.rows()) {
+            throw std::invalid_argument("result size differs from the rows of the table");
+        }
+        columns_.clear();
+        for (auto&& name : inputs_) {
+            columns_.push_back(table.column(name).data());
+        }
+        scratch_.resize(slots_ * chunk_size);
+        size_t row = 0;
+        for (; row + chunk_size <= table.rows(); row += chunk_size) {
+            exec(row, std::integral_constant<size_t, chunk_size>(), result.data() + row);
+        }
+        if (row != table.rows()) {
+            exec(row, table.rows() - row, result.data() + row);
+        }
+    }
+
+    // Free variables, the columns a table needs
+    const std::vector<std::string>& inputs() const
+    {
+        return inputs_;
+    }
+
+    // Lowering, one operand per node
+
+    struct Operand
+    {
+        enum Kind
+        {
+            constant,
+            input, // index in inputs_
+            slot,  // temporary column
+        };
+
+        Kind kind;
+        int  value;
+
+        bool operator==(const Operand&) const = default;
+    };
+
+    Operand operator()(const Integer& i)
+    {
+        return { Operand::constant, i.value };
+    }
+
+    Operand operator()(const Variable& var)
+    {
+        for (auto it = scopes_.rbegin(); it != scopes_.rend(); ++it) {
+            if (it->first == var.name) {
+                return it->second;
+            }
+        }
+        auto input = std::find(inputs_.begin(), inputs_.end(), var.name);
+        if (input == inputs_.end()) {
+            input = inputs_.insert(input, var.name);
+        }
+        return { Operand::input, int(input - inputs_.begin()) };
+    }
+
+    Operand operator()(const Bin_op& bop)
+    {
+        Operand lhs = std::visit(*this, *bop.lhs);
+        Operand rhs = std::visit(*this, *bop.rhs);
+        Opcode  op  = opcode(bop.op);
+        if (lhs.kind == Operand::constant and rhs.kind == Operand::constant) {
+            if (auto res = fold(bop.op, lhs.value, rhs.value)) {
+                return { Operand::constant, *res };
+            }
+        }
+        // the result never shares the slot of an operand, the loops rely on it
+        Operand dst = allocate();
+        release(lhs);
+        release(rhs);
+        ops_.push_back({ op, lhs, rhs, dst.value });
+        return dst;
+    }
+
+    Operand operator()(const Let& let)
+    {
+        Operand value = std::visit(*this, *let.var_expr);
+        pin(value, 1);
+        scopes_.emplace_back(let.var_name, value);
+        Operand body = std::visit(*this, *let.in_expr);
+        scopes_.pop_back();
+        pin(value, -1);
+        if (not(body == value)) {
+            release(value);
+        }
+        return body;
+    }
+
+private:
+    struct Op
+    {
+        Opcode  op;
+        Operand lhs;
+        Operand rhs;
+        int     dst;
+    };
+
+    Operand allocate()
+    {
+        if (free_.empty()) {
+            pins_.push_back(0);
+            return { Operand::slot, int(slots_++) };
+        }
+        int slot = free_.back();
+        free_.pop_back();
+        return { Operand::slot, slot };
+    }
+
+    // A slot is free once consumed, unless a let still binds it
+    void release(Operand operand)
+    {
+        if (operand.kind == Operand::slot and pins_[operand.value] == 0) {
+            free_.push_back(operand.value);
+        }
+    }
+
+    void pin(Operand operand, int count)
+    {
+        if (operand.kind == Operand::slot) {
+            pins_[operand.value] += count;
+        }
+    }
+
+    // Execution, n rows from row: a constant chunk_size for the full chunks, so that the
+    // loops have a known trip count
+
+    struct Column
+    {
+        const int* values;
+
+        int operator[](size_t i) const
+        {
+            return values[i];
+        }
+    };
+
+    struct Broadcast
+    {
+        int value;
+
+        int operator[](size_t) const
+        {
+            return value;
+        }
+    };
+
+    template <typename Count>
+    void exec(size_t row, Count n, int* result)
+    {
+        for (auto&& op : ops_) {
+            int* dst = scratch_.data() + size_t(op.dst) * chunk_size;
+            if (op.lhs.kind == Operand::constant and op.rhs.kind == Operand::constant) {
+                // only an operation that can't be folded, e.g. a division by 0
+                binary(op.op, dst, Broadcast { op.lhs.value }, Broadcast { op.rhs.value }, n);
+            } else if (op.lhs.kind == Operand::constant) {
+                binary(op.op, dst, Broadcast { op.lhs.value }, column(op.rhs, row), n);
+            } else if (op.rhs.kind == Operand::constant) {
+                binary(op.op, dst, column(op.lhs, row), Broadcast { op.rhs.value }, n);
+            } else {
+                binary(op.op, dst, column(op.lhs, row), column(op.rhs, row), n);
+            }
+        }
+        if (result_.kind == Operand::constant) {
+            std::fill_n(result, size_t(n), result_.value);
+        } else {
+            std::copy_n(column(result_, row).values, size_t(n), result);
+        }
+    }
+
+    Column column(Operand operand, size_t row) const
+    {
+        if (operand.kind == Operand::input) {
+            return { columns_[operand.value] + row };
+        }
+        return { scratch_.data() + size_t(operand.value) * chunk_size };
+    }
+
+    template <typename Lhs, typename Rhs, typename Count>
+    static void binary(Opcode op, int* __restrict dst, Lhs lhs, Rhs rhs, Count n)
+    {
+        switch (op) {
+        case Opcode::add:
+            for (size_t i = 0; i != n; ++i) {
+                dst[i] = lhs[i] + rhs[i];
+            }
+            return;
+        case Opcode::sub:
+            for (size_t i = 0; i != n; ++i) {
+                dst[i] = lhs[i] - rhs[i];
+            }
+            return;
+        case Opcode::mul:
+            for (size_t i = 0; i != n; ++i) {
+                dst[i] = lhs[i] * rhs[i];
+            }
+            return;
+        default:
+            for (size_t i = 0; i != n; ++i) {
+                dst[i] = lhs[i] / rhs[i];
+            }
+            return;
+        }
+    }
+
+    std::vector<Op>                               ops_;
+    std::vector<std::string>                      inputs_;
+    Operand                                       result_;
+    size_t                                        slots_ = 0;
+    std::vector<int>                              pins_; // lets binding each slot
+    std::vector<int>                              free_;
+    std::vector<std::pair<std::string, Operand>>  scopes_; // innermost last
+    std::vector<const int*>                       columns_;
+    std::vector<int>                              scratch_; // slots_ columns of chunk_size
+};
+
+};
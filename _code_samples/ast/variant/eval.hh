@@ -0,0 +1,126 @@
+#pragma once
+
+#include <exception>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <variant>
+
+#include "ast.hh"
+
+namespace variant::ast {
+
+struct Pretty_printer
+{
+    Pretty_printer(std::ostream& o = std::cout) : out(o) {}
+
+    void operator()(const Integer& i)
+    {
+        out << i.value;
+    }
+
+    void operator()(const Variable& var)
+    {
+        out << var.name;
+    }
+
+    void operator()(const Bin_op& bop)
+    {
+        out << "(";
+        std::visit(*this, *bop.lhs);
+        out << " " << bop.op << " ";
+        std::visit(*this, *bop.rhs);
+        out << ")";
+    }
+
+    void operator()(const Let& let)
+    {
+        out << "let " << let.var_name << " = ";
+        std::visit(*this, *let.var_expr);
+        out << " in ";
+        std::visit(*this, *let.in_expr);
+    }
+
+    std::ostream& out;
+};
+
+struct Undefined_variable : public std::exception
+{
+    Undefined_variable(std::string v) : msg(std::string("unknown variable ") + v) {}
+
+    const char* what() const noexcept override
+    {
+        return msg.c_str();
+    }
+
+    std::string msg;
+};
+
+struct Undefined_operator : public std::exception
+{
+    Undefined_operator(std::string v) : msg(std::string("unknown operator ") + v) {}
+
+    const char* what() const noexcept override
+    {
+        return msg.c_str();
+    }
+
+    std::string msg;
+};
+
+inline int apply(const std::string& op, int lhs, int rhs)
+{
+    if (op == "+") {
+        return lhs + rhs;
+    }
+    if (op == "-") {
+        return lhs - rhs;
+    }
+    if (op == "*") {
+        return lhs * rhs;
+    }
+    if (op == "/") {
+        return lhs / rhs;
+    }
+    throw Undefined_operator(op);
+}
+
+struct Eval
+{
+    void operator()(const Integer& i)
+    {
+        res = i.value;
+    }
+
+    void operator()(const Variable& var)
+    {
+        if (not env.contains(var.name)) {
+            throw Undefined_variable(var.name);
+        }
+        res = env[var.name];
+    }
+
+    void operator()(const Bin_op& bop)
+    {
+        std::visit(*this, *bop.lhs);
+        int lres = res;
+        std::visit(*this, *bop.rhs);
+        res = apply(bop.op, lres, res);
+    }
+
+    void operator()(const Let& let)
+    {
+        std::visit(*this, *let.var_expr);
+        env[let.var_name] = res;
+
+        Eval sub(*this);
+        std::visit(sub, *let.in_expr);
+        res = sub.res;
+    }
+
+    int res = 0;
+
+    std::unordered_map<std::string, int> env;
+};
+
+};
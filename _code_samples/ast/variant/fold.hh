@@ -0,0 +1,182 @@
+#pragma once
+
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include "ast.hh"
+
+namespace variant::ast {
+
+inline size_t node_count(const Node& node)
+{
+    if (auto* bop = std::get_if<Bin_op>(&node)) {
+        return 1 + node_count(*bop->lhs) + node_count(*bop->rhs);
+    }
+    if (auto* let = std::get_if<Let>(&node)) {
+        return 1 + node_count(*let->var_expr) + node_count(*let->in_expr);
+    }
+    return 1;
+}
+
+// Result of an operation on constants, nothing when it isn't defined (a division by 0) or
+// overflows, which is left for the evaluation to run into
+inline std::optional<int> fold(const std::string& op, long long lhs, long long rhs)
+{
+    long long res;
+    if (op == "+") {
+        res = lhs + rhs;
+    } else if (op == "-") {
+        res = lhs - rhs;
+    } else if (op == "*") {
+        res = lhs * rhs;
+    } else if (op == "/" and rhs != 0) {
+        res = lhs / rhs;
+    } else {
+        return {};
+    }
+    if (res < std::numeric_limits<int>::min() or res > std::numeric_limits<int>::max()) {
+        return {};
+    }
+    return int(res);
+}
+
+// Rewrites an expression into a smaller one giving the same result, meant to run once when
+// the expression is loaded:
+//  - operations on constants are computed, unless they would divide by 0 or overflow
+//  - constants bound by a let replace the variable in the body
+//  - x + 0, 0 + x, x - 0, x * 1, 1 * x and x / 1 become x, x * 0 and 0 * x become 0
+//  - lets whose variable isn't used anymore are removed
+// Variables are bound lexically. Errors in a removed subtree (an undefined variable, a
+// division by 0) are removed with it. Nodes are reused, so resolve the result again before
+// using Stack_eval.
+class Simplifier
+{
+public:
+    static std::unique_ptr<Node> simplify(std::unique_ptr<Node> node)
+    {
+        Simplifier simplifier;
+        return simplifier.rewrite(std::move(node));
+    }
+
+private:
+    struct Binding
+    {
+        std::string        name;
+        std::optional<int> value; // when bound to a constant
+    };
+
+    static const int* constant(const Node& node)
+    {
+        auto* i = std::get_if<Integer>(&node);
+        return i ? &i->value : nullptr;
+    }
+
+    static bool is(const int* value, int expected)
+    {
+        return value and *value == expected;
+    }
+
+    std::unique_ptr<Node> rewrite(std::unique_ptr<Node> node)
+    {
+        if (auto* var = std::get_if<Variable>(node.get())) {
+            return rewrite_variable(*var, std::move(node));
+        }
+        if (auto* bop = std::get_if<Bin_op>(node.get())) {
+            return rewrite_bin_op(*bop, std::move(node));
+        }
+        if (auto* let = std::get_if<Let>(node.get())) {
+            return rewrite_let(*let, std::move(node));
+        }
+        return node;
+    }
+
+    std::unique_ptr<Node> rewrite_variable(const Variable& var, std::unique_ptr<Node> node)
+    {
+        for (auto it = scopes_.rbegin(); it != scopes_.rend(); ++it) {
+            if (it->name == var.name) {
+                if (it->value) {
+                    return integer(*it->value);
+                }
+                break;
+            }
+        }
+        return node;
+    }
+
+    std::unique_ptr<Node> rewrite_bin_op(Bin_op& bop, std::unique_ptr<Node> node)
+    {
+        bop.lhs      = rewrite(std::move(bop.lhs));
+        bop.rhs      = rewrite(std::move(bop.rhs));
+        const int* l = constant(*bop.lhs);
+        const int* r = constant(*bop.rhs);
+        if (l and r) {
+            if (auto res = fold(bop.op, *l, *r)) {
+                return integer(*res);
+            }
+        }
+        if (bop.op == "+" and is(r, 0)) {
+            return std::move(bop.lhs);
+        }
+        if (bop.op == "+" and is(l, 0)) {
+            return std::move(bop.rhs);
+        }
+        if (bop.op == "-" and is(r, 0)) {
+            return std::move(bop.lhs);
+        }
+        if (bop.op == "*" and (is(l, 0) or is(r, 0))) {
+            return integer(0);
+        }
+        if ((bop.op == "*" or bop.op == "/") and is(r, 1)) {
+            return std::move(bop.lhs);
+        }
+        if (bop.op == "*" and is(l, 1)) {
+            return std::move(bop.rhs);
+        }
+        return node;
+    }
+
+    std::unique_ptr<Node> rewrite_let(Let& let, std::unique_ptr<Node> node)
+    {
+        let.var_expr = rewrite(std::move(let.var_expr));
+        if (auto value = constant(*let.var_expr)) {
+            // every use is replaced by the value, the let itself is gone
+            scopes_.push_back({ let.var_name, *value });
+            auto body = rewrite(std::move(let.in_expr));
+            scopes_.pop_back();
+            return body;
+        }
+        scopes_.push_back({ let.var_name, {} });
+        let.in_expr = rewrite(std::move(let.in_expr));
+        scopes_.pop_back();
+        // looked for in the rewritten body, the uses it had may have been folded away
+        if (not uses(*let.in_expr, let.var_name)) {
+            return std::move(let.in_expr);
+        }
+        return node;
+    }
+
+    // Whether name is free in node
+    static bool uses(const Node& node, const std::string& name)
+    {
+        if (auto* var = std::get_if<Variable>(&node)) {
+            return var->name == name;
+        }
+        if (auto* bop = std::get_if<Bin_op>(&node)) {
+            return uses(*bop->lhs, name) or uses(*bop->rhs, name);
+        }
+        if (auto* let = std::get_if<Let>(&node)) {
+            return uses(*let->var_expr, name)
+                   or (let->var_name != name and uses(*let->in_expr, name));
+        }
+        return false;
+    }
+
+    std::vector<Binding> scopes_; // innermost last
+};
+
+};
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+#include "ast.hh"
+#include "eval.hh"
+
+namespace variant::ast {
+
+// Evaluates with a stack of pending operations on the heap instead of one call per node, so
+// the depth of the tree is only limited by memory. Left operands are reached in a loop, and
+// leaves on the right are read in place, which makes a left-deep chain of operations a
+// single loop. Variables are bound lexically. The stacks are kept from one run to the next.
+class Iterative_eval
+{
+public:
+    int run(const Node& node, const std::unordered_map<std::string, int>& env = {})
+    {
+        frames_.clear();
+        values_.clear();
+        for (auto&& [name, values] : bindings_) {
+            values.clear(); // left over by an exception
+        }
+        env_ = &env;
+
+        const Node* next = &node;
+        for (;;) {
+            int value = descend(*next);
+            next      = ascend(value);
+            if (not next) {
+                return value;
+            }
+        }
+    }
+
+private:
+    enum class Step
+    {
+        rhs,   // the left operand is done
+        apply, // both operands are done, the left one on values_
+        bind,  // the value of the let is done
+        unbind,
+    };
+
+    struct Frame
+    {
+        const Node* node;
+        Step        step;
+    };
+
+    // Pushes frames down the tree until a leaf, and returns its value
+    int descend(const Node& node)
+    {
+        const Node* n = &node;
+        for (;;) {
+            if (auto* bop = std::get_if<Bin_op>(n)) {
+                frames_.push_back({ n, Step::rhs });
+                n = bop->lhs.get();
+            } else if (auto* let = std::get_if<Let>(n)) {
+                frames_.push_back({ n, Step::bind });
+                n = let->var_expr.get();
+            } else {
+                return *leaf(*n);
+            }
+        }
+    }
+
+    // Completes the frames value finishes, and returns the next node to descend into, or
+    // nullptr when value is the result
+    const Node* ascend(int& value)
+    {
+        while (not frames_.empty()) {
+            auto& frame = frames_.back();
+            switch (frame.step) {
+            case Step::rhs: {
+                auto& bop = std::get<Bin_op>(*frame.node);
+                if (auto rhs = leaf(*bop.rhs)) {
+                    value = apply(bop.op, value, *rhs);
+                    frames_.pop_back();
+                    break;
+                }
+                values_.push_back(value);
+                frame.step = Step::apply;
+                return bop.rhs.get();
+            }
+            case Step::apply:
+                value = apply(std::get<Bin_op>(*frame.node).op, values_.back(), value);
+                values_.pop_back();
+                frames_.pop_back();
+                break;
+            case Step::bind: {
+                auto& let = std::get<Let>(*frame.node);
+                bindings_[let.var_name].push_back(value);
+                frame.step = Step::unbind;
+                return let.in_expr.get();
+            }
+            case Step::unbind:
+                bindings_[std::get<Let>(*frame.node).var_name].pop_back();
+                frames_.pop_back();
+                break;
+            }
+        }
+        return nullptr;
+    }
+
+    // Value of an Integer or Variable, nothing for the other nodes
+    std::optional<int> leaf(const Node& node) const
+    {
+        if (auto* i = std::get_if<Integer>(&node)) {
+            return i->value;
+        }
+        auto* var = std::get_if<Variable>(&node);
+        if (not var) {
+            return {};
+        }
+        auto bound = bindings_.find(var->name);
+        if (bound != bindings_.end() and not bound->second.empty()) {
+            return bound->second.back();
+        }
+        auto input = env_->find(var->name);
+        if (input == env_->end()) {
+            throw Undefined_variable(var->name);
+        }
+        return input->second;
+    }
+
+    std::vector<Frame> frames_;
+    std::vector<int>   values_; // left operands waiting for the right one
+    // values of the let bound variables, innermost last
+    std::unordered_map<std::string, std::vector<int>> bindings_;
+    const std::unordered_map<std::string, int>*       env_ = nullptr;
+};
+
+// Same output as Pretty_printer, from a stack of what remains to print
+class Iterative_printer
+{
+public:
+    explicit Iterative_printer(std::ostream& out = std::cout) : out_(out) {}
+
+    void print(const Node& node)
+    {
+        pending_.assign(1, &node);
+        while (not pending_.empty()) {
+            auto item = pending_.back();
+            pending_.pop_back();
+            if (auto* text = std::get_if<std::string_view>(&item)) {
+                out_ << *text;
+            } else {
+                print_node(*std::get<const Node*>(item));
+            }
+        }
+    }
+
+private:
+    using Item = std::variant<const Node*, std::string_view>;
+
+    // Prints the beginning of node, and pushes the rest in reverse order
+    void print_node(const Node& node)
+    {
+        if (auto* i = std::get_if<Integer>(&node)) {
+            out_ << i->value;
+        } else if (auto* var = std::get_if<Variable>(&node)) {
+            out_ << var->name;
+        } else if (auto* bop = std::get_if<Bin_op>(&node)) {
+            out_ << "(";
+            pending_.push_back(std::string_view(")"));
+            pending_.push_back(bop->rhs.get());
+            pending_.push_back(std::string_view(" "));
+            pending_.push_back(std::string_view(bop->op));
+            pending_.push_back(std::string_view(" "));
+            pending_.push_back(bop->lhs.get());
+        } else {
+            auto& let = std::get<Let>(node);
+            out_ << "let " << let.var_name << " = ";
+            pending_.push_back(let.in_expr.get());
+            pending_.push_back(std::string_view(" in "));
+            pending_.push_back(let.var_expr.get());
+        }
+    }
+
+    std::ostream&     out_;
+    std::vector<Item> pending_;
+};
+
+// Frees a tree without recursing: the destructor of a unique_ptr<Node> frees the children
+// of the node first, one call per level, which overflows the stack on very deep trees.
+inline void destroy(std::unique_ptr<Node> node)
+{
+    std::vector<std::unique_ptr<Node>> pending;
+    pending.push_back(std::move(node));
+    while (not pending.empty()) {
+        auto n = std::move(pending.back());
+        pending.pop_back();
+        if (not n) {
+            continue;
+        }
+        if (auto* bop = std::get_if<Bin_op>(n.get())) {
+            pending.push_back(std::move(bop->lhs));
+            pending.push_back(std::move(bop->rhs));
+        } else if (auto* let = std::get_if<Let>(n.get())) {
+            pending.push_back(std::move(let->var_expr));
+            pending.push_back(std::move(let->in_expr));
+        }
+    }
+}
+
+};
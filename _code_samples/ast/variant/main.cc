@@ -1,123 +1,27 @@
 #include <iostream>
+#include <string>
 #include <memory>
+#include <sstream>
 #include <unordered_map>
 #include <variant>
+#include <vector>
 
+#include "../../bench/bench.hh"
 #include "ast.hh"
+#include "bytecode.hh"
+#include "columnar.hh"
+#include "eval.hh"
+#include "fold.hh"
+#include "iterative.hh"
+#include "parse.hh"
+#include "resolve.hh"
 
 using namespace variant::ast;
 
-struct Pretty_printer
+int main(int argc, char** argv)
 {
-    void operator()(const Integer& i)
-    {
-        std::cout << i.value;
-    }
-
-    void operator()(const Variable& var)
-    {
-        std::cout << var.name;
-    }
-
-    void operator()(const Bin_op& bop)
-    {
-        std::cout << "(";
-        std::visit(*this, *bop.lhs);
-        std::cout << " " << bop.op << " ";
-        std::visit(*this, *bop.rhs);
-        std::cout << ")";
-    }
-
-    void operator()(const Let& let)
-    {
-        std::cout << "let " << let.var_name << " = ";
-        std::visit(*this, *let.var_expr);
-        std::cout << " in ";
-        std::visit(*this, *let.in_expr);
-    }
-};
-
-struct Undefined_variable : public std::exception
-{
-    Undefined_variable(std::string v) : msg(std::string("unknown variable ") + v) {}
-
-    const char* what() const noexcept override
-    {
-        return msg.c_str();
-    }
-
-    std::string msg;
-};
-
-struct Undefined_operator : public std::exception
-{
-    Undefined_operator(std::string v) : msg(std::string("unknown operator ") + v) {}
-
-    const char* what() const noexcept override
-    {
-        return msg.c_str();
-    }
-
-    std::string msg;
-};
-
-struct Eval
-{
-    void operator()(const Integer& i)
-    {
-        res = i.value;
-    }
-
-    void operator()(const Variable& var)
-    {
-        if (not env.contains(var.name)) {
-            throw Undefined_variable(var.name);
-        }
-        res = env[var.name];
-    }
-
-    void operator()(const Bin_op& bop)
-    {
-        std::visit(*this, *bop.lhs);
-        int lres = res;
-        std::visit(*this, *bop.rhs);
+    bench::runner runner { argc, argv };
 
-        if (bop.op == "+") {
-            res = lres + res;
-            return;
-        }
-        if (bop.op == "-") {
-            res = lres - res;
-            return;
-        }
-        if (bop.op == "*") {
-            res = lres * res;
-            return;
-        }
-        if (bop.op == "/") {
-            res = lres / res;
-            return;
-        }
-        throw Undefined_operator(bop.op);
-    }
-
-    void operator()(const Let& let)
-    {
-        std::visit(*this, *let.var_expr);
-        env[let.var_name] = res;
-
-        Eval sub(*this);
-        std::visit(sub, *let.in_expr);
-        res = sub.res;
-    }
-
-    int res = 0;
-
-    std::unordered_map<std::string, int> env;
-};
-
-int main()
-{
     auto expr =
         let("x", integer(3), bin_op(bin_op(integer(1), integer(2), "+"), variable("x"), "+"));
     Pretty_printer pretty_printer {};
@@ -127,4 +31,179 @@ int main()
     Eval eval {};
     std::visit(eval, *expr);
     std::cout << eval.res << std::endl;
+
+    auto program = Compiler::compile(*expr);
+    Vm   vm;
+    std::cout << vm.run(program) << " (" << program.code.size() << " instructions)\n\n";
+
+    // x is an input, so nothing here is known at compile time
+    auto rule = bin_op(bin_op(bin_op(variable("x"), integer(2), "*"),
+                              let("y", bin_op(variable("x"), integer(1), "+"), variable("y")),
+                              "+"),
+                       bin_op(variable("x"), integer(3), "-"),
+                       "/");
+    auto rule_program = Compiler::compile(*rule);
+    int  x            = 7;
+    runner.run("tree walk", [&] {
+        Eval rule_eval {};
+        rule_eval.env["x"] = x;
+        std::visit(rule_eval, *rule);
+        return rule_eval.res;
+    });
+    runner.run("bytecode", [&] { return vm.run(rule_program, { &x, 1 }); });
+    auto rule_inputs = Scope_resolver::resolve(*rule);
+    runner.run("resolved tree walk", [&] {
+        Stack_eval rule_eval { rule_inputs, { &x, 1 } };
+        std::visit(rule_eval, *rule);
+        return rule_eval.res;
+    });
+
+    // let x0 = x in let x1 = (x0 + 1) in ... x100: every let copies the whole env in Eval
+    std::unique_ptr<Node> nested = variable("x100");
+    for (int i = 100; i != 0; --i) {
+        auto value = bin_op(variable("x" + std::to_string(i - 1)), integer(1), "+");
+        nested     = let("x" + std::to_string(i), std::move(value), std::move(nested));
+    }
+    nested = let("x0", variable("x"), std::move(nested));
+    runner.run("nested lets, tree walk", [&] {
+        Eval nested_eval {};
+        nested_eval.env["x"] = x;
+        std::visit(nested_eval, *nested);
+        return nested_eval.res;
+    });
+    auto nested_inputs = Scope_resolver::resolve(*nested);
+    runner.run("nested lets, resolved", [&] {
+        Stack_eval nested_eval { nested_inputs, { &x, 1 } };
+        std::visit(nested_eval, *nested);
+        return nested_eval.res;
+    });
+
+    // a mostly constant rule: let k = 2 * 5 in (x * (k - 9)) + ((1 + 2) * (k / 10 - 1))
+    auto constant_rule = let(
+        "k",
+        bin_op(integer(2), integer(5), "*"),
+        bin_op(bin_op(variable("x"), bin_op(variable("k"), integer(9), "-"), "*"),
+               bin_op(bin_op(integer(1), integer(2), "+"),
+                      bin_op(bin_op(variable("k"), integer(10), "/"), integer(1), "-"),
+                      "*"),
+               "+"));
+    std::cout << "\n";
+    std::visit(pretty_printer, *constant_rule);
+    std::cout << " (" << node_count(*constant_rule) << " nodes) is\n";
+    auto folded = Simplifier::simplify(std::move(constant_rule));
+    std::visit(pretty_printer, *folded);
+    std::cout << " (" << node_count(*folded) << " nodes)\n";
+    // the only use of y is folded away, and the let with it
+    auto dead_let = let("y", variable("x"), bin_op(variable("y"), integer(0), "*"));
+    std::visit(pretty_printer, *dead_let);
+    std::cout << " (" << node_count(*dead_let) << " nodes) is ";
+    dead_let = Simplifier::simplify(std::move(dead_let));
+    std::visit(pretty_printer, *dead_let);
+    std::cout << " (" << node_count(*dead_let) << " nodes)\n";
+    runner.run("folded tree walk", [&] {
+        Eval folded_eval {};
+        folded_eval.env["x"] = x;
+        std::visit(folded_eval, *folded);
+        return folded_eval.res;
+    });
+
+    // x + 1 - 2 + 3 ... as deep as the operations, to show the stack, not the tree, limits
+    // the recursive visitors
+    auto chain = [](int depth) {
+        std::unique_ptr<Node> chain = variable("x");
+        for (int i = 1; i <= depth; ++i) {
+            chain = bin_op(std::move(chain), integer(i % 10), i % 2 ? "+" : "-");
+        }
+        return chain;
+    };
+    std::unordered_map<std::string, int> env { { "x", x } };
+    Iterative_eval                       iterative;
+    std::cout << "\niterative eval: " << iterative.run(*rule, env) << " "
+              << iterative.run(*nested, env) << " " << iterative.run(*folded, env) << "\n";
+
+    constexpr int short_depth = 10'000;
+    auto          short_chain = chain(short_depth);
+    runner.run(
+        "chain of 10000, tree walk",
+        [&] {
+            Eval chain_eval {};
+            chain_eval.env = env;
+            std::visit(chain_eval, *short_chain);
+            return chain_eval.res;
+        },
+        short_depth);
+    runner.run("chain of 10000, iterative",
+               [&] { return iterative.run(*short_chain, env); },
+               short_depth);
+
+    constexpr int      depth      = 1'000'000;
+    auto               deep_chain = chain(depth);
+    std::ostringstream chain_text;
+    Iterative_printer  chain_printer { chain_text };
+    chain_printer.print(*deep_chain);
+    std::cout << "chain of " << depth << ": " << iterative.run(*deep_chain, env) << ", "
+              << chain_text.str().size() << " characters printed\n";
+    runner.run(
+        "chain of 1000000, iterative", [&] { return iterative.run(*deep_chain, env); }, depth);
+    runner.run(
+        "chain of 1000000, iterative print",
+        [&] {
+            chain_text.str({});
+            chain_printer.print(*deep_chain);
+            return chain_text.tellp();
+        },
+        depth);
+    destroy(std::move(deep_chain));
+
+    // reading the million nested parentheses back, and a file of 100000 rules
+    Parser parser;
+    auto   parsed = parser.parse(chain_text.str());
+    std::cout << "parsed back to " << iterative.run(*parsed, env) << "\n";
+    destroy(std::move(parsed));
+    std::string chain_source = chain_text.str();
+    runner.run(
+        "parse+free chain of 1000000, per byte",
+        [&] {
+            auto tree = parser.parse(chain_source);
+            destroy(std::move(tree));
+        },
+        chain_source.size());
+    std::ostringstream rules_text;
+    Pretty_printer     rules_printer { rules_text };
+    for (int i = 0; i != 100'000; ++i) {
+        std::visit(rules_printer, *rule);
+        rules_text << "\n";
+    }
+    std::string rules_source = rules_text.str();
+    std::cout << parser.parse_lines(rules_source).size() << " rules parsed from "
+              << rules_source.size() << " bytes\n";
+    runner.run(
+        "parse 100000 rules, per byte",
+        [&] { return parser.parse_lines(rules_source).size(); },
+        rules_source.size());
+
+    // the rule over a million rows of x, row by row and column by column
+    constexpr size_t rows = 1'000'000;
+    std::vector<int> xs(rows);
+    for (size_t i = 0; i != rows; ++i) {
+        xs[i] = int(i % 1000) + 4; // x - 3 is never 0
+    }
+    Table table { rows };
+    table.add("x", xs);
+    Column_eval      column_eval { *rule };
+    std::vector<int> results(rows);
+    runner.run(
+        "rule over 1000000 rows, bytecode per row",
+        [&] {
+            for (size_t i = 0; i != rows; ++i) {
+                results[i] = vm.run(rule_program, { &xs[i], 1 });
+            }
+        },
+        rows);
+    auto by_row = results;
+    runner.run("rule over 1000000 rows, columnar",
+               [&] { column_eval.run(table, results); },
+               rows);
+    std::cout << "columnar results " << (results == by_row ? "match" : "differ") << "\n";
+    runner.write_json();
 }
@@ -0,0 +1,323 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <limits>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ast.hh"
+#include "iterative.hh"
+
+namespace variant::ast {
+
+struct Parse_error : public std::exception
+{
+    Parse_error(std::string r, size_t o) :
+      reason(std::move(r)), offset(o), msg(reason + " at offset " + std::to_string(o))
+    {}
+
+    const char* what() const noexcept override
+    {
+        return msg.c_str();
+    }
+
+    std::string reason;
+    size_t      offset; // in the text given to the parser
+    std::string msg;
+};
+
+enum class Token_kind
+{
+    integer,
+    identifier,
+    let,
+    in,
+    op, // + - * /
+    equal,
+    open,
+    close,
+    end,
+};
+
+// A token is a view on the text, nothing is copied
+struct Token
+{
+    Token_kind       kind;
+    std::string_view text;
+};
+
+class Lexer
+{
+public:
+    explicit Lexer(std::string_view text) : text_(text) {}
+
+    Token next()
+    {
+        while (pos_ != text_.size() and is_space(text_[pos_])) {
+            ++pos_;
+        }
+        start_ = pos_;
+        if (pos_ == text_.size()) {
+            return { Token_kind::end, {} };
+        }
+        char c = text_[pos_];
+        if (is_digit(c)) {
+            return take(Token_kind::integer, is_digit);
+        }
+        if (is_alpha(c)) {
+            Token token = take(Token_kind::identifier, is_alnum);
+            if (token.text == "let") {
+                token.kind = Token_kind::let;
+            } else if (token.text == "in") {
+                token.kind = Token_kind::in;
+            }
+            return token;
+        }
+        ++pos_;
+        switch (c) {
+        case '+':
+        case '-':
+        case '*':
+        case '/':
+            return { Token_kind::op, text_.substr(start_, 1) };
+        case '=':
+            return { Token_kind::equal, text_.substr(start_, 1) };
+        case '(':
+            return { Token_kind::open, text_.substr(start_, 1) };
+        case ')':
+            return { Token_kind::close, text_.substr(start_, 1) };
+        }
+        throw Parse_error(std::string("unexpected character '") + c + "'", start_);
+    }
+
+    // Offset of the last token
+    size_t offset() const
+    {
+        return start_;
+    }
+
+private:
+    static bool is_space(char c)
+    {
+        return c == ' ' or c == '\t' or c == '\n' or c == '\r';
+    }
+
+    static bool is_digit(char c)
+    {
+        return c >= '0' and c <= '9';
+    }
+
+    static bool is_alpha(char c)
+    {
+        return (c >= 'a' and c <= 'z') or (c >= 'A' and c <= 'Z') or c == '_';
+    }
+
+    static bool is_alnum(char c)
+    {
+        return is_alpha(c) or is_digit(c);
+    }
+
+    Token take(Token_kind kind, bool (*in_token)(char))
+    {
+        while (pos_ != text_.size() and in_token(text_[pos_])) {
+            ++pos_;
+        }
+        return { kind, text_.substr(start_, pos_ - start_) };
+    }
+
+    std::string_view text_;
+    size_t           pos_   = 0;
+    size_t           start_ = 0;
+};
+
+// Reads what Pretty_printer writes:
+//  expr := integer | -integer | name | ( expr ) | expr op expr | let name = expr in expr
+// with * and / before + and -, all left associative, and the body of a let going as far
+// as possible: Pretty_printer writes a let on the left of an operation without parentheses,
+// which reads back with the operation in the body of the let. Precedence climbing on
+// explicit stacks of operands and pending operators, not recursion, so the nesting of the
+// text is only limited by memory. The parser keeps its stacks from one expression to the
+// next.
+class Parser
+{
+public:
+    std::unique_ptr<Node> parse(std::string_view text)
+    {
+        Lexer lexer(text);
+        operands_.clear();
+        pending_.clear();
+        try {
+            return read_expression(lexer);
+        } catch (...) {
+            // the operands read so far may be deep already, their destructors would recurse
+            for (auto&& operand : operands_) {
+                destroy(std::move(operand));
+            }
+            operands_.clear();
+            throw;
+        }
+    }
+
+    // One expression per line, blank lines skipped
+    std::vector<std::unique_ptr<Node>> parse_lines(std::string_view text)
+    {
+        std::vector<std::unique_ptr<Node>> nodes;
+        size_t                             start = 0;
+        while (start < text.size()) {
+            size_t end  = std::min(text.find('\n', start), text.size());
+            auto   line = text.substr(start, end - start);
+            if (line.find_first_not_of(" \t\r") != std::string_view::npos) {
+                try {
+                    nodes.push_back(parse(line));
+                } catch (const Parse_error& e) {
+                    throw Parse_error(e.reason, start + e.offset);
+                }
+            }
+            start = end + 1;
+        }
+        return nodes;
+    }
+
+private:
+    struct Pending
+    {
+        enum Kind
+        {
+            op,
+            open,
+            let_value, // let name = ...
+            let_body,  // let name = value in ...
+        };
+
+        Kind             kind;
+        std::string_view text; // operator or let variable
+        int              prec = 0;
+    };
+
+    static int precedence(std::string_view op)
+    {
+        return op == "*" or op == "/" ? 2 : 1;
+    }
+
+    static void expect(bool ok, const char* what, const Lexer& lexer)
+    {
+        if (not ok) {
+            throw Parse_error(what, lexer.offset());
+        }
+    }
+
+    std::unique_ptr<Node> read_expression(Lexer& lexer)
+    {
+        for (;;) {
+            read_operand(lexer);
+            Token token = lexer.next();
+            while (token.kind == Token_kind::close) {
+                reduce(0);
+                expect(not pending_.empty() and pending_.back().kind == Pending::open,
+                       "unbalanced )",
+                       lexer);
+                pending_.pop_back();
+                token = lexer.next();
+            }
+            if (token.kind == Token_kind::op) {
+                int prec = precedence(token.text);
+                reduce(prec);
+                pending_.push_back({ Pending::op, token.text, prec });
+            } else if (token.kind == Token_kind::in) {
+                reduce(0);
+                expect(not pending_.empty() and pending_.back().kind == Pending::let_value,
+                       "in without let",
+                       lexer);
+                pending_.back().kind = Pending::let_body;
+            } else {
+                expect(token.kind == Token_kind::end, "expected an operator", lexer);
+                reduce(0);
+                expect(pending_.empty(), "unexpected end", lexer);
+                return std::move(operands_.back());
+            }
+        }
+    }
+
+    // Reads the next operand, pushing the ( and let ... = found before it
+    void read_operand(Lexer& lexer)
+    {
+        for (;;) {
+            Token token = lexer.next();
+            switch (token.kind) {
+            case Token_kind::integer:
+                operands_.push_back(integer(to_int(token.text, false, lexer)));
+                return;
+            case Token_kind::identifier:
+                operands_.push_back(variable(std::string(token.text)));
+                return;
+            case Token_kind::open:
+                pending_.push_back({ Pending::open, token.text });
+                break;
+            case Token_kind::let: {
+                Token name = lexer.next();
+                expect(name.kind == Token_kind::identifier, "expected a variable", lexer);
+                expect(lexer.next().kind == Token_kind::equal, "expected =", lexer);
+                pending_.push_back({ Pending::let_value, name.text });
+                break;
+            }
+            default:
+                // a literal is the only thing a - applies to, as printed for negative ones
+                if (token.text == "-") {
+                    Token number = lexer.next();
+                    expect(number.kind == Token_kind::integer, "expected a number", lexer);
+                    operands_.push_back(integer(to_int(number.text, true, lexer)));
+                    return;
+                }
+                expect(false, "expected an expression", lexer);
+            }
+        }
+    }
+
+    static int to_int(std::string_view digits, bool negative, const Lexer& lexer)
+    {
+        uint64_t value = 0;
+        auto     r     = std::from_chars(digits.data(), digits.data() + digits.size(), value);
+        uint64_t limit = uint64_t(std::numeric_limits<int>::max()) + (negative ? 1 : 0);
+        expect(r.ec == std::errc() and value <= limit, "number out of range", lexer);
+        return negative ? int(-int64_t(value)) : int(value);
+    }
+
+    // Builds the pending operators of at least prec, and the let bodies they end in
+    void reduce(int prec)
+    {
+        while (not pending_.empty()) {
+            auto& top = pending_.back();
+            if (top.kind == Pending::op and top.prec >= prec) {
+                auto rhs = std::move(operands_.back());
+                operands_.pop_back();
+                operands_.back() = bin_op(std::move(operands_.back()), std::move(rhs),
+                                          std::string(top.text));
+            } else if (top.kind == Pending::let_body and prec == 0) {
+                auto in_expr = std::move(operands_.back());
+                operands_.pop_back();
+                operands_.back() = let(std::string(top.text), std::move(operands_.back()),
+                                       std::move(in_expr));
+            } else {
+                return;
+            }
+            pending_.pop_back();
+        }
+    }
+
+    std::vector<std::unique_ptr<Node>> operands_;
+    std::vector<Pending>               pending_;
+};
+
+// e.g. parse("let x = 3 in ((1 + 2) + x)")
+inline std::unique_ptr<Node> parse(std::string_view text)
+{
+    return Parser().parse(text);
+}
+
+};
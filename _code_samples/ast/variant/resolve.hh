@@ -0,0 +1,130 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include "ast.hh"
+#include "eval.hh"
+
+namespace variant::ast {
+
+// Sets the de Bruijn index of every Variable: the number of values pushed on the stack
+// after its own. The inputs (free variables) are at the bottom of the stack, the first one
+// deepest, then each let pushes its value while its body runs.
+class Scope_resolver
+{
+public:
+    // Returns the inputs, in the order Stack_eval expects them
+    static std::vector<std::string> resolve(Node& node)
+    {
+        Scope_resolver resolver;
+        std::visit(resolver, node);
+        int count = int(resolver.inputs_.size());
+        for (auto&& use : resolver.free_) {
+            use.var->index = use.depth + count - 1 - use.input;
+        }
+        return std::move(resolver.inputs_);
+    }
+
+    void operator()(Integer&) {}
+
+    void operator()(Variable& var)
+    {
+        auto bound = std::find(scopes_.rbegin(), scopes_.rend(), var.name);
+        if (bound != scopes_.rend()) {
+            var.index = int(bound - scopes_.rbegin());
+            return;
+        }
+        // the index depends on the number of inputs, only known at the end
+        auto input = std::find(inputs_.begin(), inputs_.end(), var.name);
+        if (input == inputs_.end()) {
+            input = inputs_.insert(input, var.name);
+        }
+        free_.push_back({ &var, int(scopes_.size()), int(input - inputs_.begin()) });
+    }
+
+    void operator()(Bin_op& bop)
+    {
+        std::visit(*this, *bop.lhs);
+        std::visit(*this, *bop.rhs);
+    }
+
+    void operator()(Let& let)
+    {
+        std::visit(*this, *let.var_expr);
+        scopes_.push_back(let.var_name);
+        std::visit(*this, *let.in_expr);
+        scopes_.pop_back();
+    }
+
+private:
+    struct Free_use
+    {
+        Variable* var;
+        int       depth; // enclosing lets
+        int       input;
+    };
+
+    std::vector<std::string> scopes_; // let bound variables, innermost last
+    std::vector<std::string> inputs_;
+    std::vector<Free_use>    free_;
+};
+
+// Evaluates a resolved expression on a flat stack of values: a let pushes its value and pops
+// it after its body, so a binding costs O(1) whatever the number of variables in scope. The
+// indices count from the top of the stack, so there must be one input per name returned by
+// Scope_resolver::resolve, no more.
+struct Stack_eval
+{
+    Stack_eval(std::span<const std::string> names, std::span<const int> inputs) :
+      stack(inputs.begin(), inputs.end())
+    {
+        if (inputs.size() < names.size()) {
+            throw Undefined_variable(names[inputs.size()]);
+        }
+        if (inputs.size() > names.size()) {
+            throw std::invalid_argument("more inputs than free variables");
+        }
+    }
+
+    void operator()(const Integer& i)
+    {
+        res = i.value;
+    }
+
+    void operator()(const Variable& var)
+    {
+        // also catches a variable that was never resolved (index -1)
+        if (size_t(var.index) >= stack.size()) {
+            throw Undefined_variable(var.name);
+        }
+        res = stack[stack.size() - 1 - var.index];
+    }
+
+    void operator()(const Bin_op& bop)
+    {
+        std::visit(*this, *bop.lhs);
+        int lres = res;
+        std::visit(*this, *bop.rhs);
+        res = apply(bop.op, lres, res);
+    }
+
+    void operator()(const Let& let)
+    {
+        std::visit(*this, *let.var_expr);
+        stack.push_back(res);
+        std::visit(*this, *let.in_expr);
+        stack.pop_back();
+    }
+
+    int res = 0;
+
+    std::vector<int> stack;
+};
+
+};
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "../variant/bytecode.hh"
+#include "ast.hh"
+#include "eval.hh"
+
+namespace inheritance::ast {
+
+// The code is the same for both trees, only the lowering differs. Programs run on the Vm of
+// the variant AST, whose errors are variant::ast exceptions.
+using variant::ast::Instr;
+using variant::ast::Opcode;
+using variant::ast::Program;
+using variant::ast::Vm;
+
+// Same lowering as variant::ast::Compiler: each let gets the slot of its nesting depth, and
+// variables are bound lexically. Variables no let binds are the inputs of the program.
+class Compiler : public Visitor
+{
+public:
+    static Program compile(Node& node)
+    {
+        Compiler compiler;
+        node.accept(&compiler);
+        compiler.emit({ Opcode::ret }, 0);
+        return std::move(compiler.program_);
+    }
+
+    void visit(Node* node) override
+    {
+        node->accept(this);
+    }
+
+    void visit(Integer* i) override
+    {
+        emit({ Opcode::push, i->value }, 1);
+    }
+
+    void visit(Variable* var) override
+    {
+        auto bound = std::find(scopes_.rbegin(), scopes_.rend(), var->name);
+        if (bound != scopes_.rend()) {
+            emit({ Opcode::load, int(scopes_.rend() - bound - 1) }, 1);
+            return;
+        }
+        auto&& inputs = program_.inputs;
+        auto   input  = std::find(inputs.begin(), inputs.end(), var->name);
+        if (input == inputs.end()) {
+            input = inputs.insert(input, var->name);
+        }
+        emit({ Opcode::input, int(input - inputs.begin()) }, 1);
+    }
+
+    void visit(Bin_op* bop) override
+    {
+        bop->lhs->accept(this);
+        bop->rhs->accept(this);
+        emit({ opcode(bop->op) }, -1);
+    }
+
+    void visit(Let* let) override
+    {
+        let->var_expr->accept(this);
+        emit({ Opcode::store, int(scopes_.size()) }, -1);
+        scopes_.push_back(let->var_name);
+        program_.slots = std::max(program_.slots, scopes_.size());
+        let->in_expr->accept(this);
+        scopes_.pop_back();
+    }
+
+private:
+    static Opcode opcode(const std::string& op)
+    {
+        try {
+            return variant::ast::opcode(op);
+        } catch (const variant::ast::Undefined_operator&) {
+            throw Undefined_operator(op);
+        }
+    }
+
+    // depth is the change of the stack depth
+    void emit(Instr instr, int depth)
+    {
+        program_.code.push_back(instr);
+        depth_ += depth;
+        program_.stack = std::max(program_.stack, depth_);
+    }
+
+    Program                  program_;
+    std::vector<std::string> scopes_; // let bound variables, innermost last
+    size_t                   depth_ = 0;
+};
+
+};
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <exception>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+
+#include "ast.hh"
+
+namespace inheritance::ast {
+
+struct Pretty_printer : public Visitor
+{
+    Pretty_printer(std::ostream& o = std::cout) : out(o) {}
+
+    void visit(Integer* i) override
+    {
+        out << i->value;
+    }
+
+    void visit(Variable* var) override
+    {
+        out << var->name;
+    }
+
+    void visit(Bin_op* bop) override
+    {
+        out << "(";
+        bop->lhs->accept(this);
+        out << " " << bop->op << " ";
+        bop->rhs->accept(this);
+        out << ")";
+    }
+
+    void visit(Let* let) override
+    {
+        out << "let " << let->var_name << " = ";
+        let->var_expr->accept(this);
+        out << " in ";
+        let->in_expr->accept(this);
+    }
+
+    void visit(Node* node) override
+    {
+        node->accept(this);
+    }
+
+    std::ostream& out;
+};
+
+struct Undefined_variable : public std::exception
+{
+    Undefined_variable(std::string v) : msg(std::string("unknown variable ") + v) {}
+
+    const char* what() const noexcept override
+    {
+        return msg.c_str();
+    }
+
+    std::string msg;
+};
+
+struct Undefined_operator : public std::exception
+{
+    Undefined_operator(std::string v) : msg(std::string("unknown operator ") + v) {}
+
+    const char* what() const noexcept override
+    {
+        return msg.c_str();
+    }
+
+    std::string msg;
+};
+
+struct Eval : public Visitor
+{
+    void visit(Node* node) override
+    {
+        node->accept(this);
+    }
+
+    void visit(Integer* i) override
+    {
+        res = i->value;
+    }
+
+    void visit(Variable* var) override
+    {
+        if (not env.contains(var->name)) {
+            throw Undefined_variable(var->name);
+        }
+        res = env[var->name];
+    }
+
+    void visit(Bin_op* bop) override
+    {
+        bop->lhs->accept(this);
+        int lres = res;
+        bop->rhs->accept(this);
+
+        if (bop->op == "+") {
+            res = lres + res;
+            return;
+        }
+        if (bop->op == "-") {
+            res = lres - res;
+            return;
+        }
+        if (bop->op == "*") {
+            res = lres * res;
+            return;
+        }
+        if (bop->op == "/") {
+            res = lres / res;
+            return;
+        }
+        throw Undefined_operator(bop->op);
+    }
+
+    void visit(Let* let) override
+    {
+        let->var_expr->accept(this);
+        env[let->var_name] = res;
+
+        Eval sub(*this);
+        let->in_expr->accept(&sub);
+        res = sub.res;
+    }
+
+    int res = 0;
+
+    std::unordered_map<std::string, int> env;
+};
+
+};
@@ -0,0 +1,349 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <fstream>
+#include <initializer_list>
+#include <iomanip>
+#include <limits>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "perf_counters.hh"
+#include "time_guard.hh"
+
+namespace bench {
+
+// Forces the compiler to consider value as used, without storing it anywhere
+template <typename T>
+inline void do_not_optimize(const T& value)
+{
+    if constexpr (std::is_trivially_copyable_v<T> and sizeof(T) <= sizeof(void*)) {
+        __asm__ __volatile__("" : : "r,m"(value) : "memory");
+    } else {
+        __asm__ __volatile__("" : : "m"(value) : "memory");
+    }
+}
+
+struct options
+{
+    // a sample runs the function enough times to last at least this long
+    std::chrono::nanoseconds min_sample_time = std::chrono::milliseconds(5);
+    // warmup stops once two consecutive samples are this close, or after warmup_time
+    double                   warmup_tolerance = 0.02;
+    std::chrono::nanoseconds warmup_time      = std::chrono::milliseconds(500);
+    size_t                   min_samples      = 10;
+    size_t                   max_samples      = 100;
+    // sampling stops after max_time once min_samples are taken
+    std::chrono::nanoseconds max_time = std::chrono::seconds(2);
+};
+
+// Statistics over the samples, all times are per iteration
+struct result
+{
+    std::string name;
+    size_t      iterations; // per sample
+    size_t      items;      // processed by one iteration, to report time per element
+    size_t      warmup_samples;
+    double      min_ns;
+    double      median_ns;
+    double      p95_ns;
+    double      p99_ns;
+    double      mean_ns;
+    double      stddev_ns;
+    double      max_ns;
+
+    std::vector<double> samples_ns;
+
+    // hardware counters per iteration over all the samples, NaN when not available
+    perf_counters::values counters;
+
+    double ipc() const
+    {
+        return counters[perf_counters::instructions] / counters[perf_counters::cycles];
+    }
+};
+
+// Nearest-rank percentile of sorted values
+inline double percentile(const std::vector<double>& sorted, double p)
+{
+    size_t rank = size_t(std::ceil(p / 100 * sorted.size()));
+    return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
+
+inline result summarize(std::string         name,
+                        size_t              iterations,
+                        size_t              items,
+                        std::vector<double> ns)
+{
+    std::vector<double> sorted = ns;
+    std::sort(sorted.begin(), sorted.end());
+    double mean = 0;
+    for (double x : ns) {
+        mean += x;
+    }
+    mean /= ns.size();
+    double var = 0;
+    for (double x : ns) {
+        var += (x - mean) * (x - mean);
+    }
+    double stddev = ns.size() > 1 ? std::sqrt(var / (ns.size() - 1)) : 0;
+    return { std::move(name),
+             iterations,
+             items,
+             0,
+             sorted.front(),
+             percentile(sorted, 50),
+             percentile(sorted, 95),
+             percentile(sorted, 99),
+             mean,
+             stddev,
+             sorted.back(),
+             std::move(ns),
+             {} };
+}
+
+// Runs benchmarks and keeps their results, optionally written as JSON at the end.
+// Command line: [--json FILE] [--filter SUBSTRING]
+class runner
+{
+public:
+    runner()
+    {
+        if (not counters_.any()) {
+            std::cout << "(hardware counters unavailable, reporting time only)\n";
+        }
+    }
+
+    runner(int argc, char** argv) : runner()
+    {
+        for (int i = 1; i < argc; ++i) {
+            std::string_view arg = argv[i];
+            if (arg == "--json" and i + 1 < argc) {
+                json_path_ = argv[++i];
+            } else if (arg == "--filter" and i + 1 < argc) {
+                filter_ = argv[++i];
+            } else {
+                throw std::invalid_argument("usage: " + std::string(argv[0])
+                                            + " [--json FILE] [--filter SUBSTRING]");
+            }
+        }
+    }
+
+    bool enabled(std::string_view name) const
+    {
+        return name.find(filter_) != std::string_view::npos;
+    }
+
+    // Measures fn(), whose result goes through do_not_optimize. items is the number of
+    // elements processed per call, used to print the time per element.
+    void run(std::string name, auto&& fn, size_t items = 1, options opts = {})
+    {
+        if (not enabled(name)) {
+            return;
+        }
+        using steady_clock = std::chrono::steady_clock;
+        perf_counters::values totals {};
+        size_t                counted = 0;
+        auto                  measure = [&](size_t iterations) {
+            for (size_t i = 0; i != iterations; ++i) {
+                if constexpr (std::is_void_v<decltype(fn())>) {
+                    fn();
+                } else {
+                    do_not_optimize(fn());
+                }
+            }
+        };
+        auto sample = [&](size_t iterations) {
+            std::chrono::nanoseconds timer;
+            {
+                time_guard clock { timer };
+                measure(iterations);
+            }
+            return timer;
+        };
+        // same as sample, also adding the hardware counters to the totals
+        auto counted_sample = [&](size_t iterations) {
+            std::chrono::nanoseconds timer;
+            perf_counters::values    counts;
+            {
+                perf_time_guard clock { timer, counters_, counts };
+                measure(iterations);
+            }
+            for (size_t e = 0; e != counts.size(); ++e) {
+                totals[e] += counts[e];
+            }
+            counted += iterations;
+            return timer;
+        };
+        auto start = steady_clock::now();
+
+        // calibration: grow the number of iterations until a sample is long enough
+        size_t iterations = 1;
+        auto   t          = counted_sample(iterations);
+        while (t < opts.min_sample_time) {
+            double ratio = t.count() ? double(opts.min_sample_time.count()) / t.count() : 10;
+            ratio        = std::min(ratio * 1.2, 10.);
+            iterations   = std::max(iterations + 1, size_t(iterations * ratio));
+            totals       = {};
+            counted      = 0;
+            t            = counted_sample(iterations);
+        }
+        if (t >= opts.max_time) {
+            // too slow to be sampled several times, that single run is all we get
+            auto r = summarize(std::move(name), iterations, items, { double(t.count()) });
+            record(std::move(r), totals, counted);
+            return;
+        }
+        totals  = {};
+        counted = 0;
+
+        // warmup: until the time per iteration stabilizes
+        size_t warmup = 0;
+        double prev   = double(t.count()) / iterations;
+        while (steady_clock::now() - start < opts.warmup_time) {
+            double cur = double(sample(iterations).count()) / iterations;
+            ++warmup;
+            if (std::abs(cur - prev) <= opts.warmup_tolerance * prev) {
+                break;
+            }
+            prev = cur;
+        }
+
+        std::vector<double> ns;
+        auto                sampling_end = steady_clock::now() + opts.max_time;
+        while (ns.size() < opts.max_samples
+               and (ns.size() < opts.min_samples or steady_clock::now() < sampling_end)) {
+            ns.push_back(double(counted_sample(iterations).count()) / iterations);
+        }
+        auto r           = summarize(std::move(name), iterations, items, std::move(ns));
+        r.warmup_samples = warmup;
+        record(std::move(r), totals, counted);
+    }
+
+    const std::vector<result>& results() const
+    {
+        return results_;
+    }
+
+    // Writes the results to the --json file, if any
+    void write_json() const
+    {
+        if (json_path_.empty()) {
+            return;
+        }
+        std::ofstream out(json_path_);
+        write_json(out);
+        if (not out) {
+            throw std::runtime_error("cannot write " + json_path_);
+        }
+    }
+
+    void write_json(std::ostream& out) const
+    {
+        auto precision = out.precision(10);
+        out << "{\n  \"benchmarks\": [";
+        for (size_t i = 0; i != results_.size(); ++i) {
+            auto&& r = results_[i];
+            out << (i ? "," : "") << "\n    {\"name\": \"" << escape(r.name) << "\""
+                << ", \"iterations\": " << r.iterations << ", \"items\": " << r.items
+                << ", \"warmup_samples\": " << r.warmup_samples
+                << ", \"samples\": " << r.samples_ns.size() << ", \"min_ns\": " << r.min_ns
+                << ", \"median_ns\": " << r.median_ns << ", \"p95_ns\": " << r.p95_ns
+                << ", \"p99_ns\": " << r.p99_ns << ", \"mean_ns\": " << r.mean_ns
+                << ", \"stddev_ns\": " << r.stddev_ns << ", \"max_ns\": " << r.max_ns;
+            for (size_t e = 0; e != r.counters.size(); ++e) {
+                if (not std::isnan(r.counters[e])) {
+                    out << ", \"" << perf_counters::names[e] << "\": " << r.counters[e];
+                }
+            }
+            if (not std::isnan(r.ipc())) {
+                out << ", \"ipc\": " << r.ipc();
+            }
+            out << "}";
+        }
+        out << "\n  ]\n}\n";
+        out.precision(precision);
+    }
+
+private:
+    static std::string escape(const std::string& s)
+    {
+        std::string r;
+        for (char c : s) {
+            if (c == '"' or c == '\\') {
+                r += '\\';
+            }
+            r += c;
+        }
+        return r;
+    }
+
+    void record(result r, const perf_counters::values& totals, size_t iterations)
+    {
+        for (size_t e = 0; e != totals.size(); ++e) {
+            r.counters[e] = counters_.available(e) ? totals[e] / iterations
+                                                   : std::numeric_limits<double>::quiet_NaN();
+        }
+        print(r);
+        results_.push_back(std::move(r));
+    }
+
+    // Time with a readable unit, e.g. 2.12ms rather than 2.12129e+06ns
+    static std::string format_ns(double ns)
+    {
+        const char* unit = "ns";
+        for (const char* next : { "us", "ms", "s" }) {
+            if (std::abs(ns) < 1000) {
+                break;
+            }
+            ns /= 1000;
+            unit = next;
+        }
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(ns < 10 ? 3 : 1) << ns << unit;
+        return out.str();
+    }
+
+    static void print(const result& r)
+    {
+        std::cout << r.name << ":\n";
+        std::cout << "  median: " << format_ns(r.median_ns) << "  p95: " << format_ns(r.p95_ns)
+                  << "  p99: " << format_ns(r.p99_ns) << "\n";
+        std::cout << "  mean: " << format_ns(r.mean_ns)
+                  << "  stddev: " << format_ns(r.stddev_ns) << " (" << r.samples_ns.size()
+                  << " samples of " << r.iterations << " iterations)\n";
+        if (r.items > 1) {
+            std::cout << "  per element: " << format_ns(r.median_ns / r.items) << "\n";
+        }
+        if (not std::isnan(r.ipc())) {
+            std::cout << "  IPC: " << r.ipc() << "\n";
+        }
+        bool header = false;
+        for (size_t e = perf_counters::l1d_misses; e != perf_counters::event_count; ++e) {
+            if (std::isnan(r.counters[e])) {
+                continue;
+            }
+            std::cout << (header ? ", " : "  per element: ") << perf_counters::names[e] << " "
+                      << r.counters[e] / r.items;
+            header = true;
+        }
+        if (header) {
+            std::cout << "\n";
+        }
+    }
+
+    perf_counters       counters_;
+    std::string         json_path_;
+    std::string         filter_;
+    std::vector<result> results_;
+};
+
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <utility>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "time_guard.hh"
+
+namespace bench {
+
+// Hardware counters read through perf_event_open. Each event is opened on its own, so an
+// event the machine (or the kernel.perf_event_paranoid setting, or a VM) doesn't allow is
+// simply reported as unavailable (NaN) while the others still work.
+// Threads the process creates after the counters are opened are counted too, summed with
+// the calling thread: a multithreaded run reports the work of all its threads.
+class perf_counters
+{
+public:
+    enum event : size_t
+    {
+        cycles,
+        instructions,
+        l1d_misses,
+        llc_misses,
+        branch_misses,
+        event_count,
+    };
+
+    static constexpr std::array<const char*, event_count> names {
+        "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses"
+    };
+
+    using values = std::array<double, event_count>;
+
+    perf_counters()
+    {
+        fds_.fill(-1);
+#ifdef __linux__
+        constexpr uint64_t l1d_read_miss = PERF_COUNT_HW_CACHE_L1D
+                                           | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                                           | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        constexpr uint64_t read_format   = PERF_FORMAT_TOTAL_TIME_ENABLED
+                                         | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        const std::array<std::pair<uint32_t, uint64_t>, event_count> events { {
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+            { PERF_TYPE_HW_CACHE, l1d_read_miss },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        } };
+        for (size_t e = 0; e != event_count; ++e) {
+            perf_event_attr attr {};
+            attr.size           = sizeof(attr);
+            attr.type           = events[e].first;
+            attr.config         = events[e].second;
+            attr.disabled       = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv     = 1;
+            attr.inherit        = 1;
+            attr.read_format    = read_format;
+            fds_[e]             = int(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+#endif
+    }
+
+    perf_counters(const perf_counters&)            = delete;
+    perf_counters& operator=(const perf_counters&) = delete;
+
+    ~perf_counters()
+    {
+#ifdef __linux__
+        for (int fd : fds_) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+#endif
+    }
+
+    bool available(size_t e) const
+    {
+        return fds_[e] >= 0;
+    }
+
+    bool any() const
+    {
+        for (size_t e = 0; e != event_count; ++e) {
+            if (available(e)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void start()
+    {
+#ifdef __linux__
+        for (int fd : fds_) {
+            if (fd >= 0) {
+                ::ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ::ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+#endif
+    }
+
+    // Counts since start(), scaled when the kernel had to multiplex the counters
+    values stop()
+    {
+        values counts;
+        counts.fill(std::numeric_limits<double>::quiet_NaN());
+#ifdef __linux__
+        for (int fd : fds_) {
+            if (fd >= 0) {
+                ::ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            }
+        }
+        for (size_t e = 0; e != event_count; ++e) {
+            uint64_t data[3]; // value, time enabled, time running
+            if (fds_[e] < 0 or ::read(fds_[e], data, sizeof(data)) != sizeof(data)
+                or data[2] == 0) {
+                continue;
+            }
+            counts[e] = double(data[0]) * data[1] / data[2];
+        }
+#endif
+        return counts;
+    }
+
+private:
+    std::array<int, event_count> fds_;
+};
+
+// time_guard also recording the hardware counters of the scope. The counters run around
+// the clock, so that neither their start nor their stop is timed.
+template <typename Duration>
+class perf_time_guard
+{
+public:
+    perf_time_guard(Duration& store, perf_counters& counters, perf_counters::values& counts) :
+      counting_(counters, counts), clock_(store)
+    {}
+
+private:
+    struct counting_scope
+    {
+        counting_scope(perf_counters& counters_, perf_counters::values& counts_) :
+          counters(counters_), counts(counts_)
+        {
+            counters.start();
+        }
+
+        ~counting_scope()
+        {
+            counts = counters.stop();
+        }
+
+        perf_counters&         counters;
+        perf_counters::values& counts;
+    };
+
+    // constructed first and destroyed last
+    counting_scope       counting_;
+    time_guard<Duration> clock_;
+};
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <chrono>
+
+template <typename Duration>
+struct time_guard
+{
+    using clock = std::chrono::steady_clock;
+
+    time_guard(Duration& store_) : ref_time(clock::now()), store(store_) {}
+
+    ~time_guard()
+    {
+        store = std::chrono::duration_cast<Duration>(clock::now() - ref_time);
+    }
+
+    clock::time_point ref_time;
+    Duration&         store;
+};
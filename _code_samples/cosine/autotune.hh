@@ -0,0 +1,113 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../bench/bench.hh"
+#include "simd.hh"
+
+// A way of computing the dot product and both squared norms, the winner of autotune() is
+// then called through its function pointer.
+struct tuned_kernel
+{
+    std::string       name;
+    simd::dot_prod_fn fn;
+};
+
+// Identifies the machine in a profile, the best kernel depends on the CPU generation
+inline std::string cpu_model()
+{
+    std::ifstream in("/proc/cpuinfo");
+    std::string   line;
+    while (std::getline(in, line)) {
+        if (line.starts_with("model name")) {
+            auto colon = line.find(':');
+            auto first = line.find_first_not_of(" \t", colon + 1);
+            if (colon != std::string::npos and first != std::string::npos) {
+                return line.substr(first);
+            }
+        }
+    }
+    return "unknown";
+}
+
+// Times every candidate on random vectors of dim elements and returns the fastest. Rounds
+// go through all the candidates in turn and the best round of each counts, so a frequency
+// change or an interruption during one round doesn't decide the winner.
+inline tuned_kernel calibrate(const std::vector<tuned_kernel>& candidates,
+                              size_t                           dim,
+                              size_t                           rounds = 5)
+{
+    if (candidates.empty()) {
+        throw std::invalid_argument("no candidate");
+    }
+    std::mt19937                          gen(42);
+    std::uniform_real_distribution<float> dist(-1, 1);
+    std::vector<float>                    u(dim);
+    std::vector<float>                    v(dim);
+    for (size_t i = 0; i != dim; ++i) {
+        u[i] = dist(gen);
+        v[i] = dist(gen);
+    }
+
+    // about a million elements per measure
+    size_t iterations = std::max<size_t>(1, (1 << 20) / (dim + 1));
+
+    std::vector<std::chrono::nanoseconds> best(candidates.size(),
+                                               std::chrono::nanoseconds::max());
+    for (size_t r = 0; r != rounds; ++r) {
+        for (size_t c = 0; c != candidates.size(); ++c) {
+            std::chrono::nanoseconds t;
+            {
+                time_guard clock { t };
+                for (size_t i = 0; i != iterations; ++i) {
+                    bench::do_not_optimize(candidates[c].fn(u.data(), v.data(), dim));
+                }
+            }
+            best[c] = std::min(best[c], t);
+        }
+    }
+    return candidates[std::min_element(best.begin(), best.end()) - best.begin()];
+}
+
+// calibrate(), unless profile_path already holds the winner for this CPU and dimension.
+// The profile is a cache with one "dim<TAB>name<TAB>cpu" line per result, a new result is
+// appended to it; an empty path always calibrates.
+inline tuned_kernel autotune(const std::vector<tuned_kernel>& candidates,
+                             size_t                           dim,
+                             const std::string&               profile_path = {})
+{
+    if (profile_path.empty()) {
+        return calibrate(candidates, dim);
+    }
+    std::string cpu = cpu_model();
+    {
+        std::ifstream in(profile_path);
+        std::string   line;
+        while (std::getline(in, line)) {
+            std::istringstream fields(line);
+            std::string        dim_field, name, model;
+            std::getline(fields, dim_field, '\t');
+            std::getline(fields, name, '\t');
+            std::getline(fields, model);
+            if (not fields or model != cpu or dim_field != std::to_string(dim)) {
+                continue;
+            }
+            for (auto&& c : candidates) {
+                if (c.name == name) {
+                    return c;
+                }
+            }
+        }
+    }
+    auto winner = calibrate(candidates, dim);
+    std::ofstream(profile_path, std::ios::app) << dim << '\t' << winner.name << '\t' << cpu
+                                               << '\n';
+    return winner;
+}
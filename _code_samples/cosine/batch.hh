@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include "simd.hh"
+
+// Inverse of the euclidean norm, 0 for a null vector so that its score ends up being 0 like
+// in cosine_simple_loop.
+inline double inv_norm(std::span<const float> v)
+{
+    double norm2 = simd::dot(v.data(), v.data(), v.size());
+    return norm2 == 0 ? 0 : 1 / std::sqrt(norm2);
+}
+
+// Scores one query against count rows of dim floats, stride floats apart, whose inverse
+// norms are already known. Only the dot products are computed here.
+inline void cosine_batch(std::span<const float>  query,
+                         const float*            rows,
+                         size_t                  stride,
+                         std::span<const double> inv_norms,
+                         std::span<double>       out)
+{
+    if (out.size() < inv_norms.size()) {
+        throw std::invalid_argument("output too small");
+    }
+    double qinv = inv_norm(query);
+    for (size_t i = 0; i != inv_norms.size(); ++i) {
+        double dp = simd::dot(query.data(), rows + i * stride, query.size());
+        out[i]    = dp < 0 ? 0 : dp * qinv * inv_norms[i];
+    }
+}
+
+// Contiguous store of candidate vectors, their norms are computed once at insertion.
+class candidate_set
+{
+public:
+    explicit candidate_set(size_t dim) : dim_(dim) {}
+
+    void insert(std::span<const float> v)
+    {
+        if (v.size() != dim_) {
+            throw std::invalid_argument("not the same size");
+        }
+        rows_.insert(rows_.end(), v.begin(), v.end());
+        inv_norms_.push_back(inv_norm(v));
+    }
+
+    void reserve(size_t count)
+    {
+        rows_.reserve(count * dim_);
+        inv_norms_.reserve(count);
+    }
+
+    size_t size() const
+    {
+        return inv_norms_.size();
+    }
+
+    size_t dim() const
+    {
+        return dim_;
+    }
+
+    std::span<const float> row(size_t i) const
+    {
+        return { rows_.data() + i * dim_, dim_ };
+    }
+
+    const float* data() const
+    {
+        return rows_.data();
+    }
+
+    std::span<const double> inv_norms() const
+    {
+        return inv_norms_;
+    }
+
+    // out[i] is the cosine between query and the i-th candidate, out must hold size() scores
+    void score(std::span<const float> query, std::span<double> out) const
+    {
+        if (query.size() != dim_) {
+            throw std::invalid_argument("not the same size");
+        }
+        cosine_batch(query, rows_.data(), dim_, inv_norms_, out);
+    }
+
+private:
+    size_t              dim_;
+    std::vector<float>  rows_;
+    std::vector<double> inv_norms_;
+};
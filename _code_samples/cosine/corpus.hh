@@ -0,0 +1,332 @@
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// On-disk corpus of vectors, meant to be mapped rather than parsed:
+//
+//   header    | 64 bytes, see corpus_header
+//   rows      | count rows of dim elements, each row padded to stride bytes, the first row
+//             | starts on an alignment boundary
+//   inv norms | optional, count doubles (inverse norms of the rows, 0 for a null row)
+//
+// Everything is stored in native byte order.
+
+enum class corpus_dtype : uint32_t
+{
+    float32 = 0,
+    float16 = 1,
+    int8    = 2,
+};
+
+template <typename T>
+constexpr corpus_dtype dtype_of();
+
+template <>
+constexpr corpus_dtype dtype_of<float>()
+{
+    return corpus_dtype::float32;
+}
+
+template <>
+constexpr corpus_dtype dtype_of<uint16_t>()
+{
+    return corpus_dtype::float16;
+}
+
+template <>
+constexpr corpus_dtype dtype_of<int8_t>()
+{
+    return corpus_dtype::int8;
+}
+
+struct corpus_header
+{
+    char         magic[8];
+    uint32_t     version;
+    corpus_dtype dtype;
+    uint64_t     dim;
+    uint64_t     count;
+    uint64_t     alignment;
+    uint64_t     stride;       // bytes between two rows
+    uint64_t     rows_offset;  // bytes from the start of the file
+    uint64_t     norms_offset; // 0 when there are no norms
+};
+
+static_assert(sizeof(corpus_header) == 64);
+
+constexpr char     corpus_magic[8] = { 'C', 'O', 'S', 'V', 'E', 'C', 'S', '\0' };
+constexpr uint32_t corpus_version  = 1;
+
+constexpr uint64_t align_up(uint64_t n, uint64_t alignment)
+{
+    return (n + alignment - 1) / alignment * alignment;
+}
+
+// Writes count rows of dim elements of type T, row(i) returning the i-th row as a range of
+// T. inv_norms is either empty or holds count values.
+template <typename T>
+void write_corpus(const std::string&      path,
+                  size_t                  dim,
+                  size_t                  count,
+                  auto&&                  row,
+                  std::span<const double> inv_norms = {},
+                  size_t                  alignment = 64)
+{
+    if (alignment == 0 or (alignment & (alignment - 1)) != 0 or alignment < alignof(double)) {
+        throw std::invalid_argument("alignment must be a power of two of at least 8");
+    }
+    if (not inv_norms.empty() and inv_norms.size() != count) {
+        throw std::invalid_argument("not the same size");
+    }
+
+    corpus_header header {};
+    std::memcpy(header.magic, corpus_magic, sizeof(corpus_magic));
+    header.version     = corpus_version;
+    header.dtype       = dtype_of<T>();
+    header.dim         = dim;
+    header.count       = count;
+    header.alignment   = alignment;
+    header.stride      = align_up(dim * sizeof(T), alignment);
+    header.rows_offset = align_up(sizeof(header), alignment);
+    if (not inv_norms.empty()) {
+        header.norms_offset = header.rows_offset + count * header.stride;
+    }
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (not out) {
+        throw std::system_error(errno, std::generic_category(), "cannot create " + path);
+    }
+    std::vector<char> padding(header.rows_offset - sizeof(header));
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(padding.data(), padding.size());
+    padding.assign(header.stride - dim * sizeof(T), 0);
+    for (size_t i = 0; i != count; ++i) {
+        auto&& r = row(i);
+        if (r.size() != dim) {
+            throw std::invalid_argument("not the same size");
+        }
+        out.write(reinterpret_cast<const char*>(r.data()), dim * sizeof(T));
+        out.write(padding.data(), padding.size());
+    }
+    out.write(reinterpret_cast<const char*>(inv_norms.data()), inv_norms.size_bytes());
+    if (not out.flush()) {
+        throw std::system_error(errno, std::generic_category(), "cannot write " + path);
+    }
+}
+
+// Rows of a mapped_corpus as elements of T
+template <typename T>
+struct corpus_rows
+{
+    const T* data;
+    size_t   stride; // in elements of T
+    size_t   dim;
+    size_t   count;
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    // Usable directly with the cosine_* functions
+    std::span<const T> row(size_t i) const
+    {
+        return { data + i * stride, dim };
+    }
+};
+
+// Read-only shared mapping of a corpus file: opening costs a few syscalls whatever the size,
+// pages are loaded on first access and shared through the page cache with every other
+// process mapping the same file.
+class mapped_corpus
+{
+public:
+    explicit mapped_corpus(const std::string& path)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "cannot open " + path);
+        }
+        struct stat st;
+        if (::fstat(fd, &st) < 0) {
+            int err = errno;
+            ::close(fd);
+            throw std::system_error(err, std::generic_category(), "cannot stat " + path);
+        }
+        size_ = st.st_size;
+        if (size_ < sizeof(corpus_header)) {
+            ::close(fd);
+            throw std::runtime_error(path + ": not a corpus file");
+        }
+        void* addr = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        int   err  = errno;
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            throw std::system_error(err, std::generic_category(), "cannot map " + path);
+        }
+        base_ = static_cast<const std::byte*>(addr);
+        try {
+            check(path);
+        } catch (...) {
+            ::munmap(const_cast<std::byte*>(base_), size_);
+            throw;
+        }
+    }
+
+    mapped_corpus(const mapped_corpus&)            = delete;
+    mapped_corpus& operator=(const mapped_corpus&) = delete;
+
+    ~mapped_corpus()
+    {
+        ::munmap(const_cast<std::byte*>(base_), size_);
+    }
+
+    const corpus_header& header() const
+    {
+        return *reinterpret_cast<const corpus_header*>(base_);
+    }
+
+    size_t size() const
+    {
+        return header().count;
+    }
+
+    size_t dim() const
+    {
+        return header().dim;
+    }
+
+    // Distance between two rows, in elements of T
+    template <typename T = float>
+    size_t stride() const
+    {
+        check_dtype<T>();
+        return header().stride / sizeof(T);
+    }
+
+    template <typename T = float>
+    const T* data() const
+    {
+        check_dtype<T>();
+        return reinterpret_cast<const T*>(base_ + header().rows_offset);
+    }
+
+    // View for reading rows one by one, the element type is only checked here
+    template <typename T = float>
+    corpus_rows<T> rows() const
+    {
+        check_dtype<T>();
+        auto&& h = header();
+        return { reinterpret_cast<const T*>(base_ + h.rows_offset),
+                 h.stride / sizeof(T),
+                 h.dim,
+                 h.count };
+    }
+
+    bool has_norms() const
+    {
+        return header().norms_offset != 0;
+    }
+
+    // Empty when the file has no norms section
+    std::span<const double> inv_norms() const
+    {
+        if (not has_norms()) {
+            return {};
+        }
+        return { reinterpret_cast<const double*>(base_ + header().norms_offset), size() };
+    }
+
+    // Hint the kernel about the access pattern of the rows, e.g. MADV_SEQUENTIAL for a scan
+    void advise(int advice) const
+    {
+        ::madvise(const_cast<std::byte*>(base_), size_, advice);
+    }
+
+private:
+    void check(const std::string& path) const
+    {
+        auto&& h = header();
+        if (std::memcmp(h.magic, corpus_magic, sizeof(corpus_magic)) != 0) {
+            throw std::runtime_error(path + ": not a corpus file");
+        }
+        if (h.version != corpus_version) {
+            throw std::runtime_error(path + ": unsupported version");
+        }
+        uint64_t element = element_size(h.dtype);
+        if (element == 0) {
+            throw std::runtime_error(path + ": unknown element type");
+        }
+        // every size below comes from the file: check each product and sum for overflow
+        uint64_t row_size;
+        uint64_t rows_size;
+        uint64_t rows_end;
+        if (__builtin_mul_overflow(h.dim, element, &row_size) or h.stride < row_size
+            or h.stride % element != 0) {
+            throw std::runtime_error(path + ": bad row stride");
+        }
+        if (h.rows_offset < sizeof(corpus_header) or h.rows_offset % element != 0) {
+            throw std::runtime_error(path + ": misaligned rows");
+        }
+        if (__builtin_mul_overflow(h.count, h.stride, &rows_size)
+            or __builtin_add_overflow(h.rows_offset, rows_size, &rows_end)
+            or rows_end > size_) {
+            throw std::runtime_error(path + ": truncated corpus file");
+        }
+        if (h.norms_offset == 0) {
+            return;
+        }
+        uint64_t norms_size;
+        uint64_t norms_end;
+        if (h.norms_offset < rows_end) {
+            throw std::runtime_error(path + ": norms overlap the rows");
+        }
+        if (h.norms_offset % alignof(double) != 0) {
+            throw std::runtime_error(path + ": misaligned norms");
+        }
+        if (__builtin_mul_overflow(h.count, sizeof(double), &norms_size)
+            or __builtin_add_overflow(h.norms_offset, norms_size, &norms_end)
+            or norms_end > size_) {
+            throw std::runtime_error(path + ": truncated corpus file");
+        }
+    }
+
+    // 0 for an unknown type
+    static uint64_t element_size(corpus_dtype dtype)
+    {
+        switch (dtype) {
+        case corpus_dtype::float32:
+            return sizeof(float);
+        case corpus_dtype::float16:
+            return sizeof(uint16_t);
+        case corpus_dtype::int8:
+            return sizeof(int8_t);
+        }
+        return 0;
+    }
+
+    template <typename T>
+    void check_dtype() const
+    {
+        if (header().dtype != dtype_of<T>()) {
+            throw std::invalid_argument("corpus element type mismatch");
+        }
+    }
+
+    const std::byte* base_ = nullptr;
+    size_t           size_ = 0;
+};
@@ -1,10 +1,25 @@
 #include <algorithm>
-#include <chrono>
+#include <array>
+#include <cstdlib>
+#include <cmath>
+#include <filesystem>
 #include <iostream>
+#include <numbers>
 #include <span>
 #include <stdexcept>
+#include <tuple>
 #include <vector>
 
+#include "../bench/bench.hh"
+#include "autotune.hh"
+#include "batch.hh"
+#include "corpus.hh"
+#include "matrix.hh"
+#include "pool.hh"
+#include "quantized.hh"
+#include "simd.hh"
+#include "topk.hh"
+
 const std::vector<float> a {
     0.0144894514,   -0.0564095229,  -0.0418090783,  0.0434705243,   0.0432062633,
     -0.0624103956,  0.0525009297,   0.0635857359,   0.0167658,      0.0161980335,
@@ -353,84 +368,140 @@ double cosine_block(auto&& u, auto&& v)
     return dp / magnitude;
 }
 
-template <typename Duration>
-struct time_guard
+// dot_prod_block as a kernel that autotune() can pick
+template <size_t SZ>
+std::tuple<double, double, double> dot_prod_block_kernel(const float* u,
+                                                         const float* v,
+                                                         size_t       n)
 {
-    using clock = std::chrono::steady_clock;
+    return dot_prod_block<SZ>(std::span { u, n }, std::span { v, n });
+}
 
-    time_guard(Duration& store_) : ref_time(clock::now()), store(store_) {}
+// Every block size and SIMD kernel worth trying on this CPU
+std::vector<tuned_kernel> cosine_candidates()
+{
+    std::vector<tuned_kernel> candidates {
+        { "block<8>", dot_prod_block_kernel<8> },
+        { "block<16>", dot_prod_block_kernel<16> },
+        { "block<32>", dot_prod_block_kernel<32> },
+        { "block<64>", dot_prod_block_kernel<64> },
+    };
+    for (auto&& k : simd::available_kernels()) {
+        candidates.push_back({ std::string("simd ") + k.name, k.fn });
+    }
+    return candidates;
+}
 
-    ~time_guard()
-    {
-        store = std::chrono::duration_cast<Duration>(clock::now() - ref_time);
+// Cosine through the kernel picked by autotune()
+double cosine_tuned(const tuned_kernel& kernel, auto&& u, auto&& v)
+{
+    if (u.size() != v.size()) {
+        throw std::invalid_argument("not the same size");
+    }
+    auto&& [dp, norm2_u, norm2_v] = kernel.fn(std::data(u), std::data(v), u.size());
+    if (dp < 0) {
+        return 0;
+    }
+    double magnitude = std::sqrt(norm2_u * norm2_v);
+    if (magnitude == 0) {
+        return 0;
     }
+    return dp / magnitude;
+}
 
-    clock::time_point ref_time;
-    Duration&         store;
-};
+// Same as cosine_block but using the explicit SIMD kernel selected at startup, only for
+// contiguous ranges of float.
+double cosine_simd(auto&& u, auto&& v)
+{
+    if (u.size() != v.size()) {
+        throw std::invalid_argument("not the same size");
+    }
+    auto&& [dp, norm2_u, norm2_v] = simd::dot_prod(std::data(u), std::data(v), u.size());
+    if (dp < 0) {
+        return 0;
+    }
+    double magnitude = std::sqrt(norm2_u * norm2_v);
+    if (magnitude == 0) {
+        return 0;
+    }
+    return dp / magnitude;
+}
+
+// Number of elements known at compile time (std::array, fixed-size std::span), or
+// std::dynamic_extent
+template <typename T>
+constexpr size_t static_extent = std::dynamic_extent;
+
+template <typename T, size_t N>
+constexpr size_t static_extent<std::array<T, N>> = N;
+
+template <typename T, size_t N>
+constexpr size_t static_extent<std::span<T, N>> = N;
 
-double result {};
+template <typename T>
+concept fixed_size_floats = static_extent<std::remove_cvref_t<T>> != std::dynamic_extent
+                            and std::is_same_v<std::ranges::range_value_t<T>, float>;
 
-template <size_t ITER>
-void test_cosine_simple_loop(auto&& v1, auto&& v2)
+// Picked over the one above when both sizes are known at compile time: no size check, and
+// the loop counts are constants. When N isn't a multiple of the width of the kernel's
+// loop, the floats left over go through a scalar tail of known length.
+double cosine_simd(fixed_size_floats auto&& u, fixed_size_floats auto&& v)
 {
-    std::chrono::nanoseconds timer;
-    {
-        time_guard clock { timer };
-        for (size_t i = 0; i != ITER; ++i) {
-            result = cosine_simple_loop(v1, v2);
-        }
+    constexpr size_t N = static_extent<std::remove_cvref_t<decltype(u)>>;
+    static_assert(N == static_extent<std::remove_cvref_t<decltype(v)>>, "not the same size");
+    auto&& [dp, norm2_u, norm2_v] = simd::dot_prod<N>(std::data(u), std::data(v));
+    if (dp < 0) {
+        return 0;
     }
-    std::cout << "total: " << timer.count() << "ns\n";
-    std::cout << "per call: " << (timer / ITER).count() << "ns\n";
+    double magnitude = std::sqrt(norm2_u * norm2_v);
+    if (magnitude == 0) {
+        return 0;
+    }
+    return dp / magnitude;
 }
 
-template <size_t ITER>
-void test_cosine_one_loop(auto&& v1, auto&& v2)
+// What top_k replaces: score everything, sort and truncate
+std::vector<hit> sort_k(const candidate_set& set, auto&& query, size_t k)
 {
-    std::chrono::nanoseconds timer;
-    {
-        time_guard clock { timer };
-        for (size_t i = 0; i != ITER; ++i) {
-            result = cosine_one_loop(v1, v2);
-        }
+    std::vector<double> scores(set.size());
+    std::vector<hit>    hits(set.size());
+    set.score(query, scores);
+    for (size_t j = 0; j != scores.size(); ++j) {
+        hits[j] = { j, scores[j] };
     }
-    std::cout << "total: " << timer.count() << "ns\n";
-    std::cout << "per call: " << (timer / ITER).count() << "ns\n";
+    std::sort(hits.begin(), hits.end(), better);
+    hits.resize(k);
+    return hits;
 }
 
-template <size_t ITER>
-void test_cosine_split(auto&& v1, auto&& v2)
+// Candidates spread on the plane spanned by a and c
+candidate_set make_candidates(size_t count)
 {
-    std::chrono::nanoseconds timer;
-    {
-        time_guard clock { timer };
-        for (size_t i = 0; i != ITER; ++i) {
-            result = cosine_split(v1, v2);
+    candidate_set      set { a.size() };
+    std::vector<float> v(a.size());
+    set.reserve(count);
+    for (size_t k = 0; k != count; ++k) {
+        double t = 2 * std::numbers::pi * k / count;
+        for (size_t i = 0; i != v.size(); ++i) {
+            v[i] = std::cos(t) * a[i] + std::sin(t) * c[i];
         }
+        set.insert(v);
     }
-    std::cout << "total: " << timer.count() << "ns\n";
-    std::cout << "per call: " << (timer / ITER).count() << "ns\n";
+    return set;
 }
 
-template <size_t ITER, size_t SZ>
-void test_cosine_block(auto&& v1, auto&& v2)
+void print_hits(const std::vector<hit>& hits)
 {
-    std::chrono::nanoseconds timer;
-    {
-        time_guard clock { timer };
-        for (size_t i = 0; i != ITER; ++i) {
-            result = cosine_block<SZ>(v1, v2);
-        }
+    for (auto&& h : hits) {
+        std::cout << " " << h.index << ":" << h.score;
     }
-    std::cout << "total: " << timer.count() << "ns\n";
-    std::cout << "per call: " << (timer / ITER).count() << "ns\n";
+    std::cout << "\n";
 }
 
-constexpr size_t max_iter = 1 << 20;
-
-int main()
+int main(int argc, char** argv)
 {
+    bench::runner runner { argc, argv };
+
     std::vector<float> v1 { 1.0, 0, 0 };
     auto               r  = cosine_simple_loop(v1, v1);
     auto               rs = cosine_split(v1, v1);
@@ -440,26 +511,102 @@ int main()
     auto ac1 = cosine_simple_loop(a, c);
     auto ac2 = cosine_split(a, c);
 
-    std::cout << ac1 << " " << ac2 << "\n";
-
-    std::cout << "\nWarm-up\n";
-    test_cosine_simple_loop<10>(a, c);
-    test_cosine_one_loop<10>(a, c);
-    test_cosine_split<10>(a, c);
-    test_cosine_block<10, 32>(a, c);
-
-    std::cout << "\nsimple loop:\n";
-    test_cosine_simple_loop<max_iter>(a, c);
-    std::cout << "\none loop:\n";
-    test_cosine_one_loop<max_iter>(a, c);
-    std::cout << "\nsplt:\n";
-    test_cosine_split<max_iter>(a, c);
-    std::cout << "\nblock:\n";
-    test_cosine_block<max_iter, 32>(a, c);
-    std::cout << "\nblock<8>:\n";
-    test_cosine_block<max_iter, 8>(a, c);
-    std::cout << "\nblock<16>:\n";
-    test_cosine_block<max_iter, 16>(a, c);
-    std::cout << "\nblock<64>:\n";
-    test_cosine_block<max_iter, 64>(a, c);
-}
\ No newline at end of file
+    auto ac3 = cosine_simd(a, c);
+
+    std::cout << ac1 << " " << ac2 << " " << ac3 << " (" << simd::best_kernel.name << ")\n\n";
+
+    runner.run("simple loop", [&] { return cosine_simple_loop(a, c); }, a.size());
+    runner.run("one loop", [&] { return cosine_one_loop(a, c); }, a.size());
+    runner.run("split", [&] { return cosine_split(a, c); }, a.size());
+    runner.run("block<32>", [&] { return cosine_block<32>(a, c); }, a.size());
+    runner.run("block<8>", [&] { return cosine_block<8>(a, c); }, a.size());
+    runner.run("block<16>", [&] { return cosine_block<16>(a, c); }, a.size());
+    runner.run("block<64>", [&] { return cosine_block<64>(a, c); }, a.size());
+    for (auto&& k : simd::available_kernels()) {
+        auto kernel = [&] { return k.fn(a.data(), c.data(), a.size()); };
+        runner.run(std::string("simd ") + k.name, kernel, a.size());
+    }
+
+    // COSINE_PROFILE names a file caching the calibration across runs
+    const char* profile = std::getenv("COSINE_PROFILE");
+    auto        tuned   = autotune(cosine_candidates(), a.size(), profile ? profile : "");
+    std::cout << "\nautotuned: " << tuned.name << " " << cosine_tuned(tuned, a, c) << "\n\n";
+    auto tuned_cosine = [&] { return cosine_tuned(tuned, a, c); };
+    runner.run("tuned (" + tuned.name + ")", tuned_cosine, a.size());
+
+    constexpr size_t       dim = 512;
+    std::array<float, dim> fa;
+    std::array<float, dim> fc;
+    std::copy(a.begin(), a.end(), fa.begin());
+    std::copy(c.begin(), c.end(), fc.begin());
+    std::cout << "\nfixed size check: " << cosine_simd(fa, fc) << " "
+              << cosine_simd(std::span<const float, dim>(fa), std::span<const float, dim>(fc))
+              << "\n\n";
+    runner.run("simd fixed<512>", [&] { return cosine_simd(fa, fc); }, dim);
+    runner.run("simd dynamic 512", [&] { return cosine_simd(a, c); }, dim);
+
+    auto                candidates = make_candidates(1024);
+    std::vector<double> scores(candidates.size());
+    candidates.score(a, scores);
+    std::cout << "\nbatch check: " << scores[1] << " " << cosine_simd(a, candidates.row(1))
+              << "\n\n";
+    auto batch = [&] {
+        candidates.score(a, scores);
+        return scores.back();
+    };
+    runner.run("batch 1024", batch, candidates.size());
+
+    auto large = make_candidates(1 << 14);
+    std::cout << "\ntop 5 of " << large.size() << ":";
+    print_hits(top_k(large, c, 5));
+    std::cout << "\n";
+    runner.run("top_k", [&] { return top_k(large, c, 10).front(); }, large.size());
+    runner.run("score + sort", [&] { return sort_k(large, c, 10).front(); }, large.size());
+
+    int8_set large_i8 { a.size() };
+    fp16_set large_f16 { a.size() };
+    for (size_t i = 0; i != large.size(); ++i) {
+        large_i8.insert(large.row(i));
+        large_f16.insert(large.row(i));
+    }
+    std::cout << "\nquantized kernel: " << simd::best_quantized_kernel.name << "\n";
+    std::cout << "float: " << large.size() * large.dim() * sizeof(float) << " bytes, int8: "
+              << large_i8.bytes() << " bytes, fp16: " << large_f16.bytes() << " bytes\n";
+    std::cout << "int8 top 5:";
+    print_hits(large_i8.top_k(c, 5));
+    std::cout << "int8 top 20 re-ranked to 5:";
+    print_hits(rerank(c, large_i8.top_k(c, 20), 5, [&](size_t i) { return large.row(i); }));
+    std::cout << "fp16 top 5:";
+    print_hits(large_f16.top_k(c, 5));
+    std::cout << "\n";
+    runner.run("top_k int8", [&] { return large_i8.top_k(c, 10).front(); }, large.size());
+    runner.run("top_k fp16", [&] { return large_f16.top_k(c, 10).front(); }, large.size());
+
+    auto path = (std::filesystem::temp_directory_path() / "cosine_corpus.bin").string();
+    auto large_row = [&](size_t i) { return large.row(i); };
+    write_corpus<float>(path, large.dim(), large.size(), large_row, large.inv_norms());
+    std::cout << "\nmapped corpus of " << std::filesystem::file_size(path) << " bytes\n";
+    runner.run("open mapped corpus", [&] { return mapped_corpus { path }.size(); });
+    mapped_corpus corpus { path };
+    std::cout << "mapped top 5:";
+    print_hits(top_k(c, corpus.data(), corpus.stride(), corpus.inv_norms(), 5));
+    std::cout << "mapped row 1: " << cosine_split(a, corpus.rows().row(1)) << "\n\n";
+    std::filesystem::remove(path);
+
+    auto                medium = make_candidates(2048);
+    std::vector<double> matrix(medium.size() * medium.size());
+    for (size_t threads : { size_t(1), size_t(std::thread::hardware_concurrency()) }) {
+        work_stealing_pool pool { threads };
+        auto               all_pairs = [&] {
+            cosine_matrix(rows_of(medium), rows_of(medium), matrix, pool);
+        };
+        runner.run("matrix 2048x2048 on " + std::to_string(pool.size()) + " threads",
+                   all_pairs,
+                   matrix.size());
+    }
+    work_stealing_pool pool;
+    auto               pairs = similar_pairs(rows_of(medium), 0.9999, pool);
+    std::cout << "\npairs above 0.9999: " << pairs.size() << "\n";
+
+    runner.write_json();
+}
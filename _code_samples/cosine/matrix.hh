@@ -0,0 +1,131 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include "batch.hh"
+#include "corpus.hh"
+#include "pool.hh"
+#include "simd.hh"
+
+// Rows of floats with their inverse norms, wherever they are stored
+struct row_matrix
+{
+    const float*            data;
+    size_t                  stride;
+    size_t                  dim;
+    std::span<const double> inv_norms;
+
+    size_t size() const
+    {
+        return inv_norms.size();
+    }
+
+    const float* row(size_t i) const
+    {
+        return data + i * stride;
+    }
+};
+
+inline row_matrix rows_of(const candidate_set& set)
+{
+    return { set.data(), set.dim(), set.dim(), set.inv_norms() };
+}
+
+inline row_matrix rows_of(const mapped_corpus& corpus)
+{
+    if (not corpus.has_norms()) {
+        throw std::invalid_argument("corpus without norms");
+    }
+    return { corpus.data(), corpus.stride(), corpus.dim(), corpus.inv_norms() };
+}
+
+// Number of rows on each side of a tile: 2 x 32 rows of 512 floats is 128KB, so both sides
+// of a tile stay in L2 while each lhs row is reused from L1 against the whole rhs side.
+constexpr size_t tile_rows = 32;
+
+inline size_t tile_count(size_t rows)
+{
+    return (rows + tile_rows - 1) / tile_rows;
+}
+
+// Calls score(i, j, cosine) for every pair of rows in the tile (ti, tj)
+inline void cosine_tile(const row_matrix& lhs,
+                        const row_matrix& rhs,
+                        size_t            ti,
+                        size_t            tj,
+                        auto&&            score)
+{
+    size_t iend = std::min((ti + 1) * tile_rows, lhs.size());
+    size_t jend = std::min((tj + 1) * tile_rows, rhs.size());
+    for (size_t i = ti * tile_rows; i < iend; ++i) {
+        for (size_t j = tj * tile_rows; j < jend; ++j) {
+            double dp = simd::dot(lhs.row(i), rhs.row(j), lhs.dim);
+            score(i, j, dp < 0 ? 0 : dp * lhs.inv_norms[i] * rhs.inv_norms[j]);
+        }
+    }
+}
+
+// Full similarity matrix, out[i * rhs.size() + j] is the cosine of lhs row i and rhs row j
+inline void cosine_matrix(const row_matrix&   lhs,
+                          const row_matrix&   rhs,
+                          std::span<double>   out,
+                          work_stealing_pool& pool)
+{
+    if (lhs.dim != rhs.dim) {
+        throw std::invalid_argument("not the same size");
+    }
+    if (out.size() < lhs.size() * rhs.size()) {
+        throw std::invalid_argument("output too small");
+    }
+    size_t tiles_j = tile_count(rhs.size());
+    pool.parallel_for(tile_count(lhs.size()) * tiles_j, [&](size_t t) {
+        cosine_tile(lhs, rhs, t / tiles_j, t % tiles_j, [&](size_t i, size_t j, double s) {
+            out[i * rhs.size() + j] = s;
+        });
+    });
+}
+
+struct similar_pair
+{
+    size_t i;
+    size_t j;
+    double score;
+};
+
+// Pairs i < j of rows whose cosine is at least threshold, only the upper triangle of tiles
+// is computed. Pairs are sorted by (i, j).
+inline std::vector<similar_pair> similar_pairs(const row_matrix&   rows,
+                                               double              threshold,
+                                               work_stealing_pool& pool)
+{
+    size_t tiles = tile_count(rows.size());
+
+    std::vector<similar_pair> pairs;
+    std::mutex                mutex;
+    pool.parallel_for(tiles * tiles, [&](size_t t) {
+        size_t ti = t / tiles;
+        size_t tj = t % tiles;
+        if (tj < ti) {
+            return;
+        }
+        std::vector<similar_pair> found;
+        cosine_tile(rows, rows, ti, tj, [&](size_t i, size_t j, double s) {
+            if (i < j and s >= threshold) {
+                found.push_back({ i, j, s });
+            }
+        });
+        if (not found.empty()) {
+            std::lock_guard lock(mutex);
+            pairs.insert(pairs.end(), found.begin(), found.end());
+        }
+    });
+    std::sort(pairs.begin(), pairs.end(), [](auto&& lhs, auto&& rhs) {
+        return lhs.i < rhs.i or (lhs.i == rhs.i and lhs.j < rhs.j);
+    });
+    return pairs;
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads running parallel loops. Each thread owns a range of the indices left
+// to run: it takes them one by one from the front, and once its range is empty it steals the
+// upper half of another thread's range, so uneven tasks still keep every thread busy.
+class work_stealing_pool
+{
+public:
+    explicit work_stealing_pool(size_t threads = std::thread::hardware_concurrency()) :
+      queues_(std::max<size_t>(threads, 1))
+    {
+        for (size_t w = 1; w < queues_.size(); ++w) {
+            workers_.emplace_back([this, w] { worker_loop(w); });
+        }
+    }
+
+    work_stealing_pool(const work_stealing_pool&)            = delete;
+    work_stealing_pool& operator=(const work_stealing_pool&) = delete;
+
+    ~work_stealing_pool()
+    {
+        {
+            std::lock_guard lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (auto&& w : workers_) {
+            w.join();
+        }
+    }
+
+    size_t size() const
+    {
+        return queues_.size();
+    }
+
+    // Runs task(i) for every i in [0, count), the calling thread takes part in the work.
+    // Returns once every task is done.
+    void parallel_for(size_t count, const std::function<void(size_t)>& task)
+    {
+        {
+            std::lock_guard lock(mutex_);
+            task_       = &task;
+            size_t step = (count + queues_.size() - 1) / queues_.size();
+            for (size_t w = 0; w != queues_.size(); ++w) {
+                std::lock_guard qlock(queues_[w].mutex);
+                queues_[w].first = std::min(w * step, count);
+                queues_[w].last  = std::min(queues_[w].first + step, count);
+            }
+            ++generation_;
+        }
+        wake_.notify_all();
+        run(0);
+        std::unique_lock lock(mutex_);
+        done_.wait(lock, [this] { return active_ == 0; });
+    }
+
+private:
+    struct alignas(64) queue
+    {
+        std::mutex mutex;
+        size_t     first = 0;
+        size_t     last  = 0;
+    };
+
+    bool pop(size_t w, size_t& i)
+    {
+        std::lock_guard lock(queues_[w].mutex);
+        if (queues_[w].first == queues_[w].last) {
+            return false;
+        }
+        i = queues_[w].first++;
+        return true;
+    }
+
+    bool steal(size_t w, size_t& i)
+    {
+        for (size_t k = 1; k != queues_.size(); ++k) {
+            auto&  victim = queues_[(w + k) % queues_.size()];
+            size_t first  = 0;
+            size_t last   = 0;
+            {
+                std::lock_guard lock(victim.mutex);
+                size_t          n = (victim.last - victim.first + 1) / 2;
+                if (n == 0) {
+                    continue;
+                }
+                first = victim.last - n;
+                last  = victim.last;
+                victim.last -= n;
+            }
+            std::lock_guard lock(queues_[w].mutex);
+            queues_[w].first = first + 1;
+            queues_[w].last  = last;
+            i                = first;
+            return true;
+        }
+        return false;
+    }
+
+    void run(size_t w)
+    {
+        size_t i;
+        while (pop(w, i) or steal(w, i)) {
+            (*task_)(i);
+        }
+    }
+
+    void worker_loop(size_t w)
+    {
+        size_t seen = 0;
+        for (;;) {
+            {
+                std::unique_lock lock(mutex_);
+                wake_.wait(lock, [&] { return stop_ or generation_ != seen; });
+                if (stop_) {
+                    return;
+                }
+                seen = generation_;
+                ++active_;
+            }
+            run(w);
+            {
+                std::lock_guard lock(mutex_);
+                --active_;
+            }
+            done_.notify_all();
+        }
+    }
+
+    std::vector<queue>       queues_;
+    std::vector<std::thread> workers_;
+
+    std::mutex                         mutex_;
+    std::condition_variable            wake_;
+    std::condition_variable            done_;
+    const std::function<void(size_t)>* task_       = nullptr;
+    size_t                             generation_ = 0;
+    size_t                             active_     = 0;
+    bool                               stop_       = false;
+};
@@ -0,0 +1,429 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "batch.hh"
+#include "simd.hh"
+#include "topk.hh"
+
+// Compact storage for the candidates: int8 codes with one scale per vector (4x smaller than
+// float) or fp16 (2x smaller). Scoring runs on the codes directly, the result can be refined
+// by re-ranking the best candidates against the float vectors when they are available.
+
+// fp16 conversions, round to nearest even, used when F16C isn't there and for storage
+inline uint16_t float_to_half(float f)
+{
+    uint32_t x    = std::bit_cast<uint32_t>(f);
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t abs  = x & 0x7FFFFFFF;
+    if (abs >= 0x7F800000) {
+        // inf or nan
+        return sign | 0x7C00 | (abs > 0x7F800000 ? 0x200 : 0);
+    }
+    if (abs >= 0x477FF000) {
+        // rounds above 65504
+        return sign | 0x7C00;
+    }
+    if (abs < 0x38800000) {
+        // half subnormal: the unit is 2^-24
+        if (abs < 0x33000000) {
+            return sign;
+        }
+        uint32_t mant  = (abs & 0x7FFFFF) | 0x800000;
+        uint32_t shift = 126 - (abs >> 23);
+        uint32_t r     = mant >> shift;
+        uint32_t rem   = mant & ((1u << shift) - 1);
+        uint32_t half  = 1u << (shift - 1);
+        if (rem > half or (rem == half and (r & 1))) {
+            ++r;
+        }
+        return sign | r;
+    }
+    uint32_t h   = (((abs >> 23) - 112) << 10) | ((abs >> 13) & 0x3FF);
+    uint32_t rem = abs & 0x1FFF;
+    if (rem > 0x1000 or (rem == 0x1000 and (h & 1))) {
+        ++h;
+    }
+    return sign | h;
+}
+
+inline float half_to_float(uint16_t h)
+{
+    uint32_t sign = uint32_t(h & 0x8000) << 16;
+    uint32_t e    = (h >> 10) & 0x1F;
+    uint32_t m    = h & 0x3FF;
+    if (e == 0) {
+        float f = m * 0x1p-24f;
+        return sign ? -f : f;
+    }
+    if (e == 31) {
+        return std::bit_cast<float>(sign | 0x7F800000 | (m << 13));
+    }
+    return std::bit_cast<float>(sign | ((e + 112) << 23) | (m << 13));
+}
+
+namespace simd {
+
+// int8 dot products are accumulated in int32: exact as long as dim < 2^31 / 127^2 (~133k)
+using dot_i8_fn  = int32_t (*)(const int8_t*, const int8_t*, size_t);
+using dot_f16_fn = double (*)(const float*, const uint16_t*, size_t);
+
+inline int32_t dot_i8_scalar(const int8_t* u, const int8_t* v, size_t n)
+{
+    int32_t r = 0;
+    for (size_t i = 0; i < n; ++i) {
+        r += int32_t(u[i]) * v[i];
+    }
+    return r;
+}
+
+inline double dot_f16_scalar(const float* u, const uint16_t* v, size_t n)
+{
+    float  dp[4] {};
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        for (size_t k = 0; k < 4; ++k) {
+            dp[k] += u[i + k] * half_to_float(v[i + k]);
+        }
+    }
+    double r = double(dp[0]) + dp[1] + dp[2] + dp[3];
+    for (; i < n; ++i) {
+        r += u[i] * half_to_float(v[i]);
+    }
+    return r;
+}
+
+#ifdef COSINE_SIMD_X86
+
+__attribute__((target("avx2"))) inline int32_t hsum256_epi32(__m256i x)
+{
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+    s         = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+    s         = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+    return _mm_cvtsi128_si32(s);
+}
+
+// int8 widened to int16 then vpmaddwd: 16 products summed pairwise into 8 int32 per step
+__attribute__((target("avx2"))) inline int32_t dot_i8_avx2(const int8_t* u,
+                                                            const int8_t* v,
+                                                            size_t        n)
+{
+    __m256i acc[2] = { _mm256_setzero_si256(), _mm256_setzero_si256() };
+    size_t  i      = 0;
+    for (; i + 32 <= n; i += 32) {
+        for (int k = 0; k < 2; ++k) {
+            auto    pu = (const __m128i*)(u + i + 16 * k);
+            auto    pv = (const __m128i*)(v + i + 16 * k);
+            __m256i x  = _mm256_cvtepi8_epi16(_mm_loadu_si128(pu));
+            __m256i y  = _mm256_cvtepi8_epi16(_mm_loadu_si128(pv));
+            acc[k]     = _mm256_add_epi32(acc[k], _mm256_madd_epi16(x, y));
+        }
+    }
+    int32_t r = hsum256_epi32(_mm256_add_epi32(acc[0], acc[1]));
+    for (; i < n; ++i) {
+        r += int32_t(u[i]) * v[i];
+    }
+    return r;
+}
+
+// Same with AVX-512 VNNI, vpdpwssd fuses the multiply-add and the accumulation
+__attribute__((target("avx512bw,avx512vnni"))) inline int32_t dot_i8_vnni(const int8_t* u,
+                                                                         const int8_t* v,
+                                                                         size_t        n)
+{
+    __m512i acc[2] = { _mm512_setzero_si512(), _mm512_setzero_si512() };
+    size_t  i      = 0;
+    for (; i + 64 <= n; i += 64) {
+        for (int k = 0; k < 2; ++k) {
+            auto    pu = (const __m256i*)(u + i + 32 * k);
+            auto    pv = (const __m256i*)(v + i + 32 * k);
+            __m512i x  = _mm512_cvtepi8_epi16(_mm256_loadu_si256(pu));
+            __m512i y  = _mm512_cvtepi8_epi16(_mm256_loadu_si256(pv));
+            acc[k]     = _mm512_dpwssd_epi32(acc[k], x, y);
+        }
+    }
+    alignas(64) int32_t lanes[16];
+    _mm512_store_si512(lanes, _mm512_add_epi32(acc[0], acc[1]));
+    int32_t r = 0;
+    for (int32_t l : lanes) {
+        r += l;
+    }
+    for (; i < n; ++i) {
+        r += int32_t(u[i]) * v[i];
+    }
+    return r;
+}
+
+__attribute__((target("avx2,fma,f16c"))) inline double dot_f16_avx2(const float*    u,
+                                                                   const uint16_t* v,
+                                                                   size_t          n)
+{
+    __m256 dp[4];
+    for (int k = 0; k < 4; ++k) {
+        dp[k] = _mm256_setzero_ps();
+    }
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        for (int k = 0; k < 4; ++k) {
+            __m256 x = _mm256_loadu_ps(u + i + 8 * k);
+            __m256 y = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(v + i + 8 * k)));
+            dp[k]    = _mm256_fmadd_ps(x, y, dp[k]);
+        }
+    }
+    double r =
+        hsum256(_mm256_add_ps(_mm256_add_ps(dp[0], dp[1]), _mm256_add_ps(dp[2], dp[3])));
+    for (; i < n; ++i) {
+        r += u[i] * half_to_float(v[i]);
+    }
+    return r;
+}
+
+#endif
+
+struct quantized_kernel
+{
+    const char* name;
+    dot_i8_fn   dot_i8;
+    dot_f16_fn  dot_f16;
+};
+
+inline quantized_kernel select_quantized_kernel()
+{
+#ifdef COSINE_SIMD_X86
+    __builtin_cpu_init();
+    bool avx2 = __builtin_cpu_supports("avx2") and __builtin_cpu_supports("fma");
+    // the fp16 kernel also needs f16c to convert its rows
+    bool       f16c    = avx2 and __builtin_cpu_supports("f16c");
+    dot_f16_fn dot_f16 = f16c ? dot_f16_avx2 : dot_f16_scalar;
+    if (avx2 and __builtin_cpu_supports("avx512bw") and __builtin_cpu_supports("avx512vnni")) {
+        return { "avx512vnni", dot_i8_vnni, dot_f16 };
+    }
+    if (avx2) {
+        return { "avx2", dot_i8_avx2, dot_f16 };
+    }
+#endif
+    return { "scalar", dot_i8_scalar, dot_f16_scalar };
+}
+
+inline const quantized_kernel best_quantized_kernel = select_quantized_kernel();
+
+}
+
+struct int8_vector
+{
+    std::vector<int8_t> codes;
+    float               scale;
+    int32_t             norm2;
+};
+
+// Symmetric quantization, v[i] ~ codes[i] * scale with codes in [-127, 127]
+inline int8_vector quantize_int8(std::span<const float> v)
+{
+    float max = 0;
+    for (float x : v) {
+        max = std::max(max, std::abs(x));
+    }
+    int8_vector q { std::vector<int8_t>(v.size()), max == 0 ? 1 : max / 127, 0 };
+    for (size_t i = 0; i != v.size(); ++i) {
+        q.codes[i] = int8_t(std::lround(v[i] / q.scale));
+    }
+    q.norm2 = simd::dot_i8_scalar(q.codes.data(), q.codes.data(), q.codes.size());
+    return q;
+}
+
+// The scales cancel out in the cosine, only the integer dot products and norms are used
+inline double cosine_int8(int32_t dp, int32_t norm2_u, int32_t norm2_v)
+{
+    if (dp <= 0 or norm2_u == 0 or norm2_v == 0) {
+        return 0;
+    }
+    return dp / std::sqrt(double(norm2_u) * norm2_v);
+}
+
+class int8_set
+{
+public:
+    explicit int8_set(size_t dim) : dim_(dim) {}
+
+    void insert(std::span<const float> v)
+    {
+        if (v.size() != dim_) {
+            throw std::invalid_argument("not the same size");
+        }
+        auto q = quantize_int8(v);
+        codes_.insert(codes_.end(), q.codes.begin(), q.codes.end());
+        scales_.push_back(q.scale);
+        norms2_.push_back(q.norm2);
+    }
+
+    size_t size() const
+    {
+        return norms2_.size();
+    }
+
+    size_t dim() const
+    {
+        return dim_;
+    }
+
+    size_t bytes() const
+    {
+        return codes_.size() + scales_.size() * sizeof(float)
+               + norms2_.size() * sizeof(int32_t);
+    }
+
+    // Approximation of the i-th vector
+    std::vector<float> dequantize(size_t i) const
+    {
+        std::vector<float> v(dim_);
+        for (size_t j = 0; j != dim_; ++j) {
+            v[j] = codes_[i * dim_ + j] * scales_[i];
+        }
+        return v;
+    }
+
+    void score(std::span<const float> query, std::span<double> out) const
+    {
+        auto q = check_and_quantize(query);
+        if (out.size() < size()) {
+            throw std::invalid_argument("output too small");
+        }
+        for (size_t i = 0; i != size(); ++i) {
+            out[i] = score(q, i);
+        }
+    }
+
+    std::vector<hit> top_k(std::span<const float> query,
+                           size_t                 k,
+                           size_t threads = std::thread::hardware_concurrency()) const
+    {
+        auto q = check_and_quantize(query);
+        return ::top_k(size(), k, threads, [&](size_t i) { return score(q, i); });
+    }
+
+private:
+    int8_vector check_and_quantize(std::span<const float> query) const
+    {
+        if (query.size() != dim_) {
+            throw std::invalid_argument("not the same size");
+        }
+        return quantize_int8(query);
+    }
+
+    double score(const int8_vector& q, size_t i) const
+    {
+        auto    dot_i8 = simd::best_quantized_kernel.dot_i8;
+        int32_t dp     = dot_i8(q.codes.data(), &codes_[i * dim_], dim_);
+        return cosine_int8(dp, q.norm2, norms2_[i]);
+    }
+
+    size_t               dim_;
+    std::vector<int8_t>  codes_;
+    std::vector<float>   scales_;
+    std::vector<int32_t> norms2_;
+};
+
+// Rows stored as fp16, the query stays in float and rows are widened on the fly
+class fp16_set
+{
+public:
+    explicit fp16_set(size_t dim) : dim_(dim) {}
+
+    void insert(std::span<const float> v)
+    {
+        if (v.size() != dim_) {
+            throw std::invalid_argument("not the same size");
+        }
+        size_t first = codes_.size();
+        for (float x : v) {
+            codes_.push_back(float_to_half(x));
+        }
+        // norm of the stored (rounded) vector, so that a row scores exactly 1 against itself
+        std::vector<float> rounded(dim_);
+        for (size_t j = 0; j != dim_; ++j) {
+            rounded[j] = half_to_float(codes_[first + j]);
+        }
+        inv_norms_.push_back(inv_norm(rounded));
+    }
+
+    size_t size() const
+    {
+        return inv_norms_.size();
+    }
+
+    size_t dim() const
+    {
+        return dim_;
+    }
+
+    size_t bytes() const
+    {
+        return codes_.size() * sizeof(uint16_t) + inv_norms_.size() * sizeof(double);
+    }
+
+    void score(std::span<const float> query, std::span<double> out) const
+    {
+        double qinv = check_and_inv_norm(query);
+        if (out.size() < size()) {
+            throw std::invalid_argument("output too small");
+        }
+        for (size_t i = 0; i != size(); ++i) {
+            out[i] = score(query, qinv, i);
+        }
+    }
+
+    std::vector<hit> top_k(std::span<const float> query,
+                           size_t                 k,
+                           size_t threads = std::thread::hardware_concurrency()) const
+    {
+        double qinv = check_and_inv_norm(query);
+        return ::top_k(size(), k, threads, [&](size_t i) { return score(query, qinv, i); });
+    }
+
+private:
+    double check_and_inv_norm(std::span<const float> query) const
+    {
+        if (query.size() != dim_) {
+            throw std::invalid_argument("not the same size");
+        }
+        return inv_norm(query);
+    }
+
+    double score(std::span<const float> query, double qinv, size_t i) const
+    {
+        auto   dot_f16 = simd::best_quantized_kernel.dot_f16;
+        double dp      = dot_f16(query.data(), &codes_[i * dim_], dim_);
+        return dp < 0 ? 0 : dp * qinv * inv_norms_[i];
+    }
+
+    size_t                dim_;
+    std::vector<uint16_t> codes_;
+    std::vector<double>   inv_norms_;
+};
+
+// Rescores candidates found on quantized data with the float vectors, row(i) returning the
+// i-th float vector, and keeps the k best. Typical use is to ask the quantized set for a few
+// times k candidates.
+inline std::vector<hit> rerank(std::span<const float> query,
+                               std::vector<hit>       candidates,
+                               size_t                 k,
+                               auto&&                 row)
+{
+    double qinv = inv_norm(query);
+    for (auto&& h : candidates) {
+        std::span<const float> v  = row(h.index);
+        double                 dp = simd::dot(query.data(), v.data(), query.size());
+        h.score                   = dp < 0 ? 0 : dp * qinv * inv_norm(v);
+    }
+    std::sort(candidates.begin(), candidates.end(), better);
+    candidates.resize(std::min(k, candidates.size()));
+    return candidates;
+}
@@ -0,0 +1,453 @@
+#pragma once
+
+#include <cstddef>
+#include <tuple>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define COSINE_SIMD_X86 1
+#endif
+
+// Hand-written kernels computing the dot product and both squared norms in one pass.
+// Each kernel keeps several independent float accumulators per quantity, so the additions
+// don't form a single dependency chain. The vector kernels add their accumulators together
+// in float, then the lanes of the result are widened to double and summed, as are the four
+// accumulators of the scalar kernel.
+// The ISA-specific kernels are compiled with target attributes, the best one is picked at
+// startup from cpuid (through __builtin_cpu_supports).
+namespace simd {
+
+using dot_prod_fn = std::tuple<double, double, double> (*)(const float*, const float*, size_t);
+using dot_fn      = double (*)(const float*, const float*, size_t);
+
+inline std::tuple<double, double, double> dot_prod_scalar(const float* u,
+                                                          const float* v,
+                                                          size_t       n)
+{
+    float  dp[4] {};
+    float  nu[4] {};
+    float  nv[4] {};
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        for (size_t k = 0; k < 4; ++k) {
+            dp[k] += u[i + k] * v[i + k];
+            nu[k] += u[i + k] * u[i + k];
+            nv[k] += v[i + k] * v[i + k];
+        }
+    }
+    double rdp = double(dp[0]) + dp[1] + dp[2] + dp[3];
+    double rnu = double(nu[0]) + nu[1] + nu[2] + nu[3];
+    double rnv = double(nv[0]) + nv[1] + nv[2] + nv[3];
+    for (; i < n; ++i) {
+        rdp += u[i] * v[i];
+        rnu += u[i] * u[i];
+        rnv += v[i] * v[i];
+    }
+    return { rdp, rnu, rnv };
+}
+
+inline double dot_scalar(const float* u, const float* v, size_t n)
+{
+    float  dp[4] {};
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        for (size_t k = 0; k < 4; ++k) {
+            dp[k] += u[i + k] * v[i + k];
+        }
+    }
+    double r = double(dp[0]) + dp[1] + dp[2] + dp[3];
+    for (; i < n; ++i) {
+        r += u[i] * v[i];
+    }
+    return r;
+}
+
+#ifdef COSINE_SIMD_X86
+
+__attribute__((target("sse2"))) inline double hsum128(__m128 x)
+{
+    __m128d s = _mm_add_pd(_mm_cvtps_pd(x), _mm_cvtps_pd(_mm_movehl_ps(x, x)));
+    return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+}
+
+__attribute__((target("sse2"))) inline std::tuple<double, double, double>
+dot_prod_sse2(const float* u, const float* v, size_t n)
+{
+    __m128 dp[4], nu[4], nv[4];
+    for (int k = 0; k < 4; ++k) {
+        dp[k] = nu[k] = nv[k] = _mm_setzero_ps();
+    }
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        for (int k = 0; k < 4; ++k) {
+            __m128 x = _mm_loadu_ps(u + i + 4 * k);
+            __m128 y = _mm_loadu_ps(v + i + 4 * k);
+            dp[k]    = _mm_add_ps(dp[k], _mm_mul_ps(x, y));
+            nu[k]    = _mm_add_ps(nu[k], _mm_mul_ps(x, x));
+            nv[k]    = _mm_add_ps(nv[k], _mm_mul_ps(y, y));
+        }
+    }
+    double rdp = hsum128(_mm_add_ps(_mm_add_ps(dp[0], dp[1]), _mm_add_ps(dp[2], dp[3])));
+    double rnu = hsum128(_mm_add_ps(_mm_add_ps(nu[0], nu[1]), _mm_add_ps(nu[2], nu[3])));
+    double rnv = hsum128(_mm_add_ps(_mm_add_ps(nv[0], nv[1]), _mm_add_ps(nv[2], nv[3])));
+    for (; i < n; ++i) {
+        rdp += u[i] * v[i];
+        rnu += u[i] * u[i];
+        rnv += v[i] * v[i];
+    }
+    return { rdp, rnu, rnv };
+}
+
+__attribute__((target("sse2"))) inline double dot_sse2(const float* u,
+                                                       const float* v,
+                                                       size_t       n)
+{
+    __m128 dp[4];
+    for (int k = 0; k < 4; ++k) {
+        dp[k] = _mm_setzero_ps();
+    }
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        for (int k = 0; k < 4; ++k) {
+            __m128 x = _mm_loadu_ps(u + i + 4 * k);
+            __m128 y = _mm_loadu_ps(v + i + 4 * k);
+            dp[k]    = _mm_add_ps(dp[k], _mm_mul_ps(x, y));
+        }
+    }
+    double r = hsum128(_mm_add_ps(_mm_add_ps(dp[0], dp[1]), _mm_add_ps(dp[2], dp[3])));
+    for (; i < n; ++i) {
+        r += u[i] * v[i];
+    }
+    return r;
+}
+
+__attribute__((target("avx2,fma"))) inline double hsum256(__m256 x)
+{
+    __m256d d = _mm256_add_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(x)),
+                              _mm256_cvtps_pd(_mm256_extractf128_ps(x, 1)));
+    __m128d s = _mm_add_pd(_mm256_castpd256_pd128(d), _mm256_extractf128_pd(d, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+}
+
+__attribute__((target("avx2,fma"))) inline std::tuple<double, double, double>
+dot_prod_avx2(const float* u, const float* v, size_t n)
+{
+    __m256 dp[4], nu[4], nv[4];
+    for (int k = 0; k < 4; ++k) {
+        dp[k] = nu[k] = nv[k] = _mm256_setzero_ps();
+    }
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        for (int k = 0; k < 4; ++k) {
+            __m256 x = _mm256_loadu_ps(u + i + 8 * k);
+            __m256 y = _mm256_loadu_ps(v + i + 8 * k);
+            dp[k]    = _mm256_fmadd_ps(x, y, dp[k]);
+            nu[k]    = _mm256_fmadd_ps(x, x, nu[k]);
+            nv[k]    = _mm256_fmadd_ps(y, y, nv[k]);
+        }
+    }
+    for (; i + 8 <= n; i += 8) {
+        __m256 x = _mm256_loadu_ps(u + i);
+        __m256 y = _mm256_loadu_ps(v + i);
+        dp[0]    = _mm256_fmadd_ps(x, y, dp[0]);
+        nu[0]    = _mm256_fmadd_ps(x, x, nu[0]);
+        nv[0]    = _mm256_fmadd_ps(y, y, nv[0]);
+    }
+    double rdp = hsum256(
+        _mm256_add_ps(_mm256_add_ps(dp[0], dp[1]), _mm256_add_ps(dp[2], dp[3])));
+    double rnu = hsum256(
+        _mm256_add_ps(_mm256_add_ps(nu[0], nu[1]), _mm256_add_ps(nu[2], nu[3])));
+    double rnv = hsum256(
+        _mm256_add_ps(_mm256_add_ps(nv[0], nv[1]), _mm256_add_ps(nv[2], nv[3])));
+    for (; i < n; ++i) {
+        rdp += u[i] * v[i];
+        rnu += u[i] * u[i];
+        rnv += v[i] * v[i];
+    }
+    return { rdp, rnu, rnv };
+}
+
+__attribute__((target("avx2,fma"))) inline double dot_avx2(const float* u,
+                                                            const float* v,
+                                                            size_t       n)
+{
+    __m256 dp[4];
+    for (int k = 0; k < 4; ++k) {
+        dp[k] = _mm256_setzero_ps();
+    }
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        for (int k = 0; k < 4; ++k) {
+            __m256 x = _mm256_loadu_ps(u + i + 8 * k);
+            __m256 y = _mm256_loadu_ps(v + i + 8 * k);
+            dp[k]    = _mm256_fmadd_ps(x, y, dp[k]);
+        }
+    }
+    for (; i + 8 <= n; i += 8) {
+        dp[0] = _mm256_fmadd_ps(_mm256_loadu_ps(u + i), _mm256_loadu_ps(v + i), dp[0]);
+    }
+    double r =
+        hsum256(_mm256_add_ps(_mm256_add_ps(dp[0], dp[1]), _mm256_add_ps(dp[2], dp[3])));
+    for (; i < n; ++i) {
+        r += u[i] * v[i];
+    }
+    return r;
+}
+
+// _mm512_reduce_add_ps trips -Wuninitialized inside gcc's own headers, so spill the lanes.
+__attribute__((target("avx512f"))) inline double hsum512(__m512 x)
+{
+    alignas(64) float lanes[16];
+    _mm512_store_ps(lanes, x);
+    double r = 0;
+    for (float l : lanes) {
+        r += l;
+    }
+    return r;
+}
+
+__attribute__((target("avx512f"))) inline std::tuple<double, double, double>
+dot_prod_avx512(const float* u, const float* v, size_t n)
+{
+    __m512 dp[4], nu[4], nv[4];
+    for (int k = 0; k < 4; ++k) {
+        dp[k] = nu[k] = nv[k] = _mm512_setzero_ps();
+    }
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        for (int k = 0; k < 4; ++k) {
+            __m512 x = _mm512_loadu_ps(u + i + 16 * k);
+            __m512 y = _mm512_loadu_ps(v + i + 16 * k);
+            dp[k]    = _mm512_fmadd_ps(x, y, dp[k]);
+            nu[k]    = _mm512_fmadd_ps(x, x, nu[k]);
+            nv[k]    = _mm512_fmadd_ps(y, y, nv[k]);
+        }
+    }
+    // remaining elements, 16 at a time, the last chunk using a masked load
+    for (; i < n; i += 16) {
+        __mmask16 m = n - i >= 16 ? __mmask16(0xFFFF) : __mmask16((1u << (n - i)) - 1);
+        __m512    x = _mm512_maskz_loadu_ps(m, u + i);
+        __m512    y = _mm512_maskz_loadu_ps(m, v + i);
+        dp[0]       = _mm512_fmadd_ps(x, y, dp[0]);
+        nu[0]       = _mm512_fmadd_ps(x, x, nu[0]);
+        nv[0]       = _mm512_fmadd_ps(y, y, nv[0]);
+    }
+    double rdp = hsum512(
+        _mm512_add_ps(_mm512_add_ps(dp[0], dp[1]), _mm512_add_ps(dp[2], dp[3])));
+    double rnu = hsum512(
+        _mm512_add_ps(_mm512_add_ps(nu[0], nu[1]), _mm512_add_ps(nu[2], nu[3])));
+    double rnv = hsum512(
+        _mm512_add_ps(_mm512_add_ps(nv[0], nv[1]), _mm512_add_ps(nv[2], nv[3])));
+    return { rdp, rnu, rnv };
+}
+
+__attribute__((target("avx512f"))) inline double dot_avx512(const float* u,
+                                                             const float* v,
+                                                             size_t       n)
+{
+    __m512 dp[4];
+    for (int k = 0; k < 4; ++k) {
+        dp[k] = _mm512_setzero_ps();
+    }
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        for (int k = 0; k < 4; ++k) {
+            __m512 x = _mm512_loadu_ps(u + i + 16 * k);
+            __m512 y = _mm512_loadu_ps(v + i + 16 * k);
+            dp[k]    = _mm512_fmadd_ps(x, y, dp[k]);
+        }
+    }
+    for (; i < n; i += 16) {
+        __mmask16 m = n - i >= 16 ? __mmask16(0xFFFF) : __mmask16((1u << (n - i)) - 1);
+        __m512    x = _mm512_maskz_loadu_ps(m, u + i);
+        __m512    y = _mm512_maskz_loadu_ps(m, v + i);
+        dp[0]       = _mm512_fmadd_ps(x, y, dp[0]);
+    }
+    return hsum512(_mm512_add_ps(_mm512_add_ps(dp[0], dp[1]), _mm512_add_ps(dp[2], dp[3])));
+}
+
+#endif
+
+// Fixed-size versions: N is a compile time constant, so there is no size to check, the loops
+// are fully unrolled and the tail disappears when N is a multiple of the vector width.
+template <size_t N>
+using fixed_dot_prod_fn = std::tuple<double, double, double> (*)(const float*, const float*);
+
+// The last N elements, fewer than a vector
+template <size_t N>
+inline std::tuple<double, double, double> dot_prod_tail(const float* u, const float* v)
+{
+    double rdp = 0, rnu = 0, rnv = 0;
+    for (size_t i = 0; i < N; ++i) {
+        rdp += u[i] * v[i];
+        rnu += u[i] * u[i];
+        rnv += v[i] * v[i];
+    }
+    return { rdp, rnu, rnv };
+}
+
+#ifdef COSINE_SIMD_X86
+
+template <size_t N>
+__attribute__((target("avx2,fma"))) inline std::tuple<double, double, double>
+dot_prod_avx2_fixed(const float* u, const float* v)
+{
+    __m256 dp[4], nu[4], nv[4];
+    for (int k = 0; k < 4; ++k) {
+        dp[k] = nu[k] = nv[k] = _mm256_setzero_ps();
+    }
+    constexpr size_t body = N / 32 * 32;
+#pragma GCC unroll 64
+    for (size_t i = 0; i < body; i += 32) {
+        for (int k = 0; k < 4; ++k) {
+            __m256 x = _mm256_loadu_ps(u + i + 8 * k);
+            __m256 y = _mm256_loadu_ps(v + i + 8 * k);
+            dp[k]    = _mm256_fmadd_ps(x, y, dp[k]);
+            nu[k]    = _mm256_fmadd_ps(x, x, nu[k]);
+            nv[k]    = _mm256_fmadd_ps(y, y, nv[k]);
+        }
+    }
+    double rdp = hsum256(
+        _mm256_add_ps(_mm256_add_ps(dp[0], dp[1]), _mm256_add_ps(dp[2], dp[3])));
+    double rnu = hsum256(
+        _mm256_add_ps(_mm256_add_ps(nu[0], nu[1]), _mm256_add_ps(nu[2], nu[3])));
+    double rnv = hsum256(
+        _mm256_add_ps(_mm256_add_ps(nv[0], nv[1]), _mm256_add_ps(nv[2], nv[3])));
+    if constexpr (body != N) {
+        auto&& [tdp, tnu, tnv] = dot_prod_tail<N - body>(u + body, v + body);
+        rdp += tdp;
+        rnu += tnu;
+        rnv += tnv;
+    }
+    return { rdp, rnu, rnv };
+}
+
+template <size_t N>
+__attribute__((target("avx512f"))) inline std::tuple<double, double, double>
+dot_prod_avx512_fixed(const float* u, const float* v)
+{
+    __m512 dp[4], nu[4], nv[4];
+    for (int k = 0; k < 4; ++k) {
+        dp[k] = nu[k] = nv[k] = _mm512_setzero_ps();
+    }
+    constexpr size_t body = N / 64 * 64;
+#pragma GCC unroll 64
+    for (size_t i = 0; i < body; i += 64) {
+        for (int k = 0; k < 4; ++k) {
+            __m512 x = _mm512_loadu_ps(u + i + 16 * k);
+            __m512 y = _mm512_loadu_ps(v + i + 16 * k);
+            dp[k]    = _mm512_fmadd_ps(x, y, dp[k]);
+            nu[k]    = _mm512_fmadd_ps(x, x, nu[k]);
+            nv[k]    = _mm512_fmadd_ps(y, y, nv[k]);
+        }
+    }
+    double rdp = hsum512(
+        _mm512_add_ps(_mm512_add_ps(dp[0], dp[1]), _mm512_add_ps(dp[2], dp[3])));
+    double rnu = hsum512(
+        _mm512_add_ps(_mm512_add_ps(nu[0], nu[1]), _mm512_add_ps(nu[2], nu[3])));
+    double rnv = hsum512(
+        _mm512_add_ps(_mm512_add_ps(nv[0], nv[1]), _mm512_add_ps(nv[2], nv[3])));
+    if constexpr (body != N) {
+        auto&& [tdp, tnu, tnv] = dot_prod_tail<N - body>(u + body, v + body);
+        rdp += tdp;
+        rnu += tnu;
+        rnv += tnv;
+    }
+    return { rdp, rnu, rnv };
+}
+
+#endif
+
+template <size_t N>
+inline std::tuple<double, double, double> dot_prod_scalar_fixed(const float* u, const float* v)
+{
+    float            dp[4] {};
+    float            nu[4] {};
+    float            nv[4] {};
+    constexpr size_t body = N / 4 * 4;
+    for (size_t i = 0; i < body; i += 4) {
+        for (size_t k = 0; k < 4; ++k) {
+            dp[k] += u[i + k] * v[i + k];
+            nu[k] += u[i + k] * u[i + k];
+            nv[k] += v[i + k] * v[i + k];
+        }
+    }
+    double rdp = double(dp[0]) + dp[1] + dp[2] + dp[3];
+    double rnu = double(nu[0]) + nu[1] + nu[2] + nu[3];
+    double rnv = double(nv[0]) + nv[1] + nv[2] + nv[3];
+    if constexpr (body != N) {
+        auto&& [tdp, tnu, tnv] = dot_prod_tail<N - body>(u + body, v + body);
+        rdp += tdp;
+        rnu += tnu;
+        rnv += tnv;
+    }
+    return { rdp, rnu, rnv };
+}
+
+struct kernel
+{
+    const char* name;
+    dot_prod_fn fn;
+    dot_fn      dot;
+};
+
+// Kernels usable on the current CPU, best first.
+inline std::vector<kernel> available_kernels()
+{
+    std::vector<kernel> kernels;
+#ifdef COSINE_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        kernels.push_back({ "avx512", dot_prod_avx512, dot_avx512 });
+    }
+    if (__builtin_cpu_supports("avx2") and __builtin_cpu_supports("fma")) {
+        kernels.push_back({ "avx2", dot_prod_avx2, dot_avx2 });
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        kernels.push_back({ "sse2", dot_prod_sse2, dot_sse2 });
+    }
+#endif
+    kernels.push_back({ "scalar", dot_prod_scalar, dot_scalar });
+    return kernels;
+}
+
+inline const kernel best_kernel = available_kernels().front();
+
+// Same choice as best_kernel, asked to the CPU again: best_fixed_kernel<N> may be
+// initialized before best_kernel, the order of the two isn't specified.
+template <size_t N>
+inline fixed_dot_prod_fn<N> select_fixed_kernel()
+{
+#ifdef COSINE_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return dot_prod_avx512_fixed<N>;
+    }
+    if (__builtin_cpu_supports("avx2") and __builtin_cpu_supports("fma")) {
+        return dot_prod_avx2_fixed<N>;
+    }
+#endif
+    return dot_prod_scalar_fixed<N>;
+}
+
+template <size_t N>
+inline const fixed_dot_prod_fn<N> best_fixed_kernel = select_fixed_kernel<N>();
+
+inline std::tuple<double, double, double> dot_prod(const float* u, const float* v, size_t n)
+{
+    return best_kernel.fn(u, v, n);
+}
+
+inline double dot(const float* u, const float* v, size_t n)
+{
+    return best_kernel.dot(u, v, n);
+}
+
+template <size_t N>
+inline std::tuple<double, double, double> dot_prod(const float* u, const float* v)
+{
+    return best_fixed_kernel<N>(u, v);
+}
+
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "batch.hh"
+#include "simd.hh"
+
+struct hit
+{
+    size_t index;
+    double score;
+};
+
+// Best first, lower index first on ties so the result doesn't depend on the thread split
+inline bool better(const hit& lhs, const hit& rhs)
+{
+    return lhs.score > rhs.score or (lhs.score == rhs.score and lhs.index < rhs.index);
+}
+
+// Keeps the k best hits pushed so far, the worst of them on top of the heap.
+class top_k_heap
+{
+public:
+    explicit top_k_heap(size_t k) : k_(k)
+    {
+        hits_.reserve(k);
+    }
+
+    bool accepts(const hit& h) const
+    {
+        return hits_.size() < k_ or better(h, hits_.front());
+    }
+
+    // Score a hit needs at least to be accepted
+    double threshold() const
+    {
+        if (hits_.size() < k_) {
+            return -std::numeric_limits<double>::infinity();
+        }
+        return k_ == 0 ? std::numeric_limits<double>::infinity() : hits_.front().score;
+    }
+
+    void push(const hit& h)
+    {
+        if (k_ == 0 or not accepts(h)) {
+            return;
+        }
+        if (hits_.size() == k_) {
+            std::pop_heap(hits_.begin(), hits_.end(), better);
+            hits_.pop_back();
+        }
+        hits_.push_back(h);
+        std::push_heap(hits_.begin(), hits_.end(), better);
+    }
+
+    void merge(const top_k_heap& other)
+    {
+        for (auto&& h : other.hits_) {
+            push(h);
+        }
+    }
+
+    std::vector<hit> sorted() &&
+    {
+        std::sort_heap(hits_.begin(), hits_.end(), better);
+        return std::move(hits_);
+    }
+
+private:
+    size_t           k_;
+    std::vector<hit> hits_;
+};
+
+// Splits count items in contiguous ranges, one per thread, scan(first, last, heap) pushing
+// the hits of a range into the heap of its thread. The heaps are merged at the end.
+inline std::vector<hit> top_k_ranges(size_t count, size_t k, size_t threads, auto&& scan)
+{
+    constexpr size_t min_items_per_thread = 4096;
+
+    threads = std::min(std::max<size_t>(threads, 1), count / min_items_per_thread + 1);
+
+    std::vector<top_k_heap>  heaps(threads, top_k_heap(k));
+    std::vector<std::thread> workers;
+    size_t                   chunk = (count + threads - 1) / threads;
+    for (size_t t = 1; t < threads; ++t) {
+        size_t first = std::min(t * chunk, count);
+        workers.emplace_back(scan, first, std::min(first + chunk, count), std::ref(heaps[t]));
+    }
+    scan(0, std::min(chunk, count), heaps[0]);
+    for (auto&& w : workers) {
+        w.join();
+    }
+    for (size_t t = 1; t < threads; ++t) {
+        heaps[0].merge(heaps[t]);
+    }
+    return std::move(heaps[0]).sorted();
+}
+
+// Exact top-k by brute force over count items, score(i) giving the score of the i-th one.
+// Each thread pushes its scores straight into its own heap, scores are never stored.
+inline std::vector<hit> top_k(size_t count, size_t k, size_t threads, auto&& score)
+{
+    return top_k_ranges(count, k, threads, [&](size_t first, size_t last, top_k_heap& heap) {
+        for (size_t i = first; i < last; ++i) {
+            heap.push({ i, score(i) });
+        }
+    });
+}
+
+// Cosine top-k over rows of floats, stride floats apart, with known inverse norms. Rows are
+// scored a tile at a time into a buffer on the stack, then only the scores reaching the
+// threshold of the heap are pushed: the scoring loop doesn't touch the heap, and once the
+// heap is full almost no row does.
+inline std::vector<hit> top_k(std::span<const float>  query,
+                              const float*            rows,
+                              size_t                  stride,
+                              std::span<const double> inv_norms,
+                              size_t                  k,
+                              size_t threads = std::thread::hardware_concurrency())
+{
+    constexpr size_t tile = 256;
+
+    if (query.size() > stride) {
+        throw std::invalid_argument("query longer than the rows");
+    }
+    double qinv = inv_norm(query);
+    auto   scan = [&](size_t first, size_t last, top_k_heap& heap) {
+        std::array<double, tile> scores;
+        for (size_t begin = first; begin < last; begin += tile) {
+            size_t n = std::min(tile, last - begin);
+            for (size_t j = 0; j != n; ++j) {
+                double dp = simd::dot(query.data(), rows + (begin + j) * stride, query.size());
+                scores[j] = dp < 0 ? 0 : dp * qinv * inv_norms[begin + j];
+            }
+            double threshold = heap.threshold();
+            for (size_t j = 0; j != n; ++j) {
+                if (scores[j] >= threshold) {
+                    heap.push({ begin + j, scores[j] });
+                    threshold = heap.threshold();
+                }
+            }
+        }
+    };
+    return top_k_ranges(inv_norms.size(), k, threads, scan);
+}
+
+inline std::vector<hit> top_k(const candidate_set&   set,
+                              std::span<const float> query,
+                              size_t                 k,
+                              size_t threads = std::thread::hardware_concurrency())
+{
+    if (query.size() != set.dim()) {
+        throw std::invalid_argument("not the same size");
+    }
+    return top_k(query, set.data(), set.dim(), set.inv_norms(), k, threads);
+}